@@ -25,213 +25,435 @@ SOFTWARE.
  */
 
 #include <blescanner.hpp>
+#include <tiltbeacon.hpp>
 #include <utils.hpp>
 
 BleScanner bleScanner;
 
-constexpr auto TILT_COLOR_RED_UUID = "a495bb10c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_GREEN_UUID = "a495bb20c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_BLACK_UUID = "a495bb30c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_PURPLE_UUID = "a495bb40c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_ORANGE_UUID = "a495bb50c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_BLUE_UUID = "a495bb60c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_YELLOW_UUID = "a495bb70c5b14b44b5121370f02d74de";
-constexpr auto TILT_COLOR_PINK_UUID = "a495bb80c5b14b44b5121370f02d74de";
+// Tilt uuid is a495bbX0-c5b1-4b44-b512-1370f02d74de where X is the color
+constexpr uint8_t TILT_COLOR_UUID[NO_TILT_COLORS][16] = {
+    {0xa4, 0x95, 0xbb, 0x10, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Red
+    {0xa4, 0x95, 0xbb, 0x20, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Green
+    {0xa4, 0x95, 0xbb, 0x30, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Black
+    {0xa4, 0x95, 0xbb, 0x40, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Purple
+    {0xa4, 0x95, 0xbb, 0x50, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Orange
+    {0xa4, 0x95, 0xbb, 0x60, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Blue
+    {0xa4, 0x95, 0xbb, 0x70, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Yellow
+    {0xa4, 0x95, 0xbb, 0x80, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+     0xf0, 0x2d, 0x74, 0xde},  // Pink
+};
 
 constexpr auto SERV_UUID = "180A";
 constexpr auto SERV2_UUID = "1801";
 constexpr auto CHAR_UUID = "2AC4";
 
-void BleDeviceCallbacks::onResult(NimBLEAdvertisedDevice* advertisedDevice) {
-  // Log.notice(F("BLE : %s,%s" CR),
-  //           advertisedDevice->getAddress().toString().c_str(),
-  //           advertisedDevice->getName().c_str());
-
-  if (advertisedDevice->getName() == "gravitymon") {
-    bool eddyStone = false;
-
-    // Print out the advertised services
-    for (int i = 0; i < advertisedDevice->getServiceDataCount(); i++)
-      // Log.notice(F("BLE : Service: %d %s %s" CR), i,
-      //            advertisedDevice->getServiceDataUUID(i).toString().c_str(),
-      //            advertisedDevice->getServiceData(i).c_str());
-
-      // Check if we have a gravitymon eddy stone beacon.
-      for (int i = 0; i < advertisedDevice->getServiceDataCount(); i++) {
-        if (advertisedDevice->getServiceDataUUID(i).toString() ==
-            "0xfeaa") {  // id for eddystone beacon
-          eddyStone = true;
-        }
-      }
+constexpr auto BLE_AD_TYPE_COMPLETE_NAME = 0x09;
+constexpr auto BLE_AD_TYPE_SERVICE_DATA16 = 0x16;
+constexpr auto BLE_AD_TYPE_MANUFACTURER_DATA = 0xff;
 
-    if (eddyStone) {
-      Log.notice(F("BLE : Processing gravitymon eddy stone beacon" CR));
-      bleScanner.processGravitymonEddystoneBeacon(
-          advertisedDevice->getAddress(), advertisedDevice->getPayload());
-    } else if (advertisedDevice->getServiceData(NimBLEUUID(SERV2_UUID)) ==
-               "gravitymon_ext") {
-      Log.notice(F("BLE : Processing gravitymon extended beacon" CR));
-      bleScanner.processGravitymonExtBeacon(
-          advertisedDevice->getAddress(),
-          advertisedDevice->getServiceData(NimBLEUUID(SERV_UUID)));
-    } else {
-      Log.notice(
-          F("BLE : Processing gravitymon device (connect with device)" CR));
-      bleScanner.processGravitymonDevice(advertisedDevice->getAddress());
+constexpr auto BLE_UUID_EDDYSTONE = 0xfeaa;
+constexpr auto BLE_UUID_SERV = 0x180a;
+constexpr auto BLE_UUID_SERV2 = 0x1801;
+
+constexpr auto GRAVITYMON_NAME = "gravitymon";
+constexpr auto GRAVITYMON_EXT_MARKER = "gravitymon_ext";
+
+// Walk the AD structures (length, type, data) once and keep pointers to the
+// fields we are interested in, nothing is copied.
+void parseAdvert(const uint8_t* payload, size_t length, BleAdvertView* view) {
+  size_t i = 0;
+
+  memset(view, 0, sizeof(BleAdvertView));
+
+  while (i + 1 < length) {
+    size_t len = payload[i];
+
+    if (len == 0 || i + 1 + len > length) break;
+
+    const uint8_t* field = payload + i + 2;
+    uint8_t fieldLength = len - 1;
+
+    switch (payload[i + 1]) {
+      case BLE_AD_TYPE_COMPLETE_NAME:
+        view->name = field;
+        view->nameLength = fieldLength;
+        break;
+
+      case BLE_AD_TYPE_MANUFACTURER_DATA:
+        if (!view->mfg) {
+          view->mfg = field;
+          view->mfgLength = fieldLength;
+        }
+        break;
+
+      case BLE_AD_TYPE_SERVICE_DATA16:
+        if (fieldLength >= 2) {
+          switch (field[0] | (field[1] << 8)) {
+            case BLE_UUID_EDDYSTONE:
+              view->eddystone = field + 2;
+              view->eddystoneLength = fieldLength - 2;
+              break;
+            case BLE_UUID_SERV:
+              view->serv = field + 2;
+              view->servLength = fieldLength - 2;
+              break;
+            case BLE_UUID_SERV2:
+              view->serv2 = field + 2;
+              view->serv2Length = fieldLength - 2;
+              break;
+          }
+        }
+        break;
     }
 
+    i += len + 1;
+  }
+}
+
+inline bool fieldEquals(const uint8_t* field, uint8_t length,
+                        const char* value) {
+  return field && length == strlen(value) && !memcmp(field, value, length);
+}
+
+inline bool isGravitymonAdvert(BleAdvertKind kind) {
+  return kind >= BLE_ADVERT_GRAVITYMON_EDDYSTONE &&
+         kind <= BLE_ADVERT_GRAVITYMON_DEVICE;
+}
+
+// Decide what kind of advert this is, unrelated devices give BLE_ADVERT_NONE.
+// Known is what the device was classified as before. A device known to be a
+// gravitymon is classified without its name since the name can be in the scan
+// response. An advert without beacon data is only a device to connect to if
+// the device has not been seen sending beacons, it's otherwise a scan
+// response or an advert without the data.
+BleAdvertKind classifyAdvert(const BleAdvertView& view, bool extended,
+                             BleAdvertKind known) {
+  bool named = fieldEquals(view.name, view.nameLength, GRAVITYMON_NAME);
+
+  if (named || (isGravitymonAdvert(known) && !view.mfg)) {
+    if (view.eddystone) return BLE_ADVERT_GRAVITYMON_EDDYSTONE;
+    if (fieldEquals(view.serv2, view.serv2Length, GRAVITYMON_EXT_MARKER))
+      return BLE_ADVERT_GRAVITYMON_EXT;
+    if (extended && view.serv) return BLE_ADVERT_GRAVITYMON_EXT;
+    if (known == BLE_ADVERT_GRAVITYMON_DEVICE ||
+        (named && known == BLE_ADVERT_NONE))
+      return BLE_ADVERT_GRAVITYMON_DEVICE;
+    return BLE_ADVERT_NONE;
+  }
+
+  if (!view.mfg || view.mfgLength < 24) return BLE_ADVERT_NONE;
+
+  // Apple company id followed by the iBeacon type and length
+  uint32_t prefix = readUint32(view.mfg);
+  if (prefix == 0x4c000215) return BLE_ADVERT_TILT;
+  if (prefix == 0x4c000315) return BLE_ADVERT_GRAVITYMON_IBEACON;
+
+  return BLE_ADVERT_NONE;
+}
+
+void BleDeviceCallbacks::onResult(NimBLEAdvertisedDevice* advertisedDevice) {
+  // Runs in the NimBLE host task, only classify and copy the raw data and let
+  // the main loop do the decoding.
+  bleScanner.queueAdvert(advertisedDevice);
+}
+
+void BleScanner::queueAdvert(NimBLEAdvertisedDevice* advertisedDevice) {
+  uint32_t start = micros();
+
+  _acceptListAdverts[_acceptListActive.load(std::memory_order_relaxed)]++;
+  queueAdvertData(advertisedDevice);
+
+  _callbackTime.fetch_add(micros() - start, std::memory_order_relaxed);
+  _callbackCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BleScanner::queueAdvertData(NimBLEAdvertisedDevice* advertisedDevice) {
+  size_t length = advertisedDevice->getPayloadLength();
+  if (length > BLE_ADVERT_MAX_PAYLOAD) length = BLE_ADVERT_MAX_PAYLOAD;
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+  bool extended = !advertisedDevice->isLegacyAdvertisement();
+#else
+  bool extended = false;
+#endif
+
+  NimBLEAddress address = advertisedDevice->getAddress();
+  uint64_t mac = static_cast<uint64_t>(address);
+  BleMacClass& entry =
+      _macClass[((mac ^ (mac >> 24)) * 2654435761u >> 16) &
+                (BLE_MAC_CLASS_SIZE - 1)];
+  bool cached = entry.mac == mac;
+
+  if (cached && entry.kind == BLE_ADVERT_NONE) {  // Known foreign device
+    _advertsIgnored++;
     return;
   }
 
-  // Check if we have a tilt iBeacon to process
+  BleAdvertView view;
+  parseAdvert(advertisedDevice->getPayload(), length, &view);
+  BleAdvertKind known = cached ? entry.kind : BLE_ADVERT_NONE;
+  BleAdvertKind kind = classifyAdvert(view, extended, known);
 
-  if (advertisedDevice->getManufacturerData().length() >= 24) {
-    if (advertisedDevice->getManufacturerData()[0] == 0x4c &&
-        advertisedDevice->getManufacturerData()[1] == 0x00 &&
-        advertisedDevice->getManufacturerData()[2] == 0x02 &&
-        advertisedDevice->getManufacturerData()[3] == 0x15) {
-      Log.notice(F("BLE : Advertised iBeacon TILT Device: %s" CR),
-                 advertisedDevice->getAddress().toString().c_str());
+  // The result is final unless this is a scannable device seen by a passive
+  // scan, then the name could be in the scan response.
+  uint8_t type = advertisedDevice->getAdvType();
+  bool scannable = type == BLE_HCI_ADV_TYPE_ADV_IND ||
+                   type == BLE_HCI_ADV_TYPE_ADV_SCAN_IND;
 
-      bleScanner.proccesTiltBeacon(advertisedDevice->getManufacturerData(),
-                                   advertisedDevice->getRSSI());
-    }
+  // A gravitymon keeps its mode when an advert has no beacon data
+  if (isGravitymonAdvert(known) && kind == BLE_ADVERT_NONE) {
+    _advertsIgnored++;
+    return;
   }
 
-  // Check if we have a gravmon iBeacon to process
+  if (kind != BLE_ADVERT_NONE || !scannable ||
+      _scanActiveNow.load(std::memory_order_relaxed)) {
+    if (!cached) _macClassified++;
+    entry.mac = mac;
+    entry.kind = kind;
+  } else {
+    _macUnknown.fetch_add(1, std::memory_order_relaxed);
+  }
 
-  if (advertisedDevice->getManufacturerData().length() >= 24) {
-    if (advertisedDevice->getManufacturerData()[0] == 0x4c &&
-        advertisedDevice->getManufacturerData()[1] == 0x00 &&
-        advertisedDevice->getManufacturerData()[2] == 0x03 &&
-        advertisedDevice->getManufacturerData()[3] == 0x15) {
-      Log.notice(F("BLE : Advertised iBeacon GRAVMON Device: %s" CR),
-                 advertisedDevice->getAddress().toString().c_str());
+  if (kind == BLE_ADVERT_NONE) {  // Phones and other beacons end here
+    _advertsIgnored++;
+    return;
+  }
 
-      bleScanner.proccesGravitymonBeacon(
-          advertisedDevice->getManufacturerData(),
-          advertisedDevice->getAddress());
+  BleAdvert* advert = _advertQueue.acquire();
+
+  if (!advert) return;  // Queue is full, counted as overflow
+
+  memcpy(&advert->mac[0], address.getNative(), sizeof(advert->mac));
+  advert->addressType = address.getType();
+  advert->rssi = advertisedDevice->getRSSI();
+  advert->length = length;
+  memcpy(&advert->payload[0], advertisedDevice->getPayload(), length);
+  advert->timestamp = getTimestamp();
+  advert->kind = kind;
+  advert->extended = extended;
+#if CONFIG_BT_NIMBLE_EXT_ADV
+  advert->coded =
+      advertisedDevice->getPrimaryPhy() == BLE_HCI_LE_PHY_CODED ||
+      advertisedDevice->getSecondaryPhy() == BLE_HCI_LE_PHY_CODED;
+#else
+  advert->coded = false;
+#endif
+  _advertQueue.commit();
+}
+
+bool BleScanner::isDuplicateAdvert(const BleAdvert& advert, uint64_t mac,
+                                   TiltColor color) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+
+  for (int i = 0; i < advert.length; i++) {
+    hash ^= advert.payload[i];
+    hash *= 16777619u;
+  }
+
+  BleAdvertCacheEntry& entry =
+      _advertCache[((mac ^ (mac >> 24)) * 2654435761u >> 16) &
+                   (BLE_ADVERT_CACHE_SIZE - 1)];
+
+  if (entry.mac == mac && entry.hash == hash) {
+    // Same data as last time, just refresh the device
+    if (color != TiltColor::None) {
+      TiltData& data = getTiltData(color);
+      data.rssi = advert.rssi;
+      data.setUpdated(advert.timestamp);
+      _advertCacheHits++;
+      return true;
+    }
+
+    int idx = _gravitymon.findByMac(mac);
+    if (idx >= 0) {  // Device could have been evicted since last time
+      getGravitymonData(idx).setUpdated(advert.timestamp);
+      _advertCacheHits++;
+      return true;
     }
   }
+
+  entry.mac = mac;
+  entry.hash = hash;
+  _advertCacheMisses++;
+  return false;
+}
+
+void BleScanner::processAdvert(const BleAdvert& advert) {
+  ble_addr_t addr;
+  addr.type = advert.addressType;
+  memcpy(&addr.val[0], &advert.mac[0], sizeof(addr.val));
+  NimBLEAddress address(addr);
+  uint64_t mac = static_cast<uint64_t>(address);
+
+  BleAdvertView view;
+  parseAdvert(&advert.payload[0], advert.length, &view);
+
+  // Log.notice(F("BLE : %s,%d" CR), address.toString().c_str(), advert.rssi);
+
+  if (advert.extended) _extendedAdverts++;
+  if (advert.coded) _codedAdverts++;
+
+  TiltColor color;
+
+  switch (advert.kind) {
+    case BLE_ADVERT_GRAVITYMON_EDDYSTONE:
+      if (isDuplicateAdvert(advert, mac, TiltColor::None)) return;
+
+      Log.notice(F("BLE : Processing gravitymon eddy stone beacon" CR));
+      processGravitymonEddystoneBeacon(address, view.eddystone,
+                                       view.eddystoneLength, advert.timestamp);
+      break;
+
+    case BLE_ADVERT_GRAVITYMON_EXT:
+      if (isDuplicateAdvert(advert, mac, TiltColor::None)) return;
+
+      Log.notice(F("BLE : Processing gravitymon extended beacon" CR));
+      processGravitymonExtBeacon(address, view.serv, view.servLength,
+                                 advert.timestamp);
+      break;
+
+    case BLE_ADVERT_GRAVITYMON_DEVICE:
+      Log.notice(
+          F("BLE : Processing gravitymon device (connect with device)" CR));
+      processGravitymonDevice(address);
+      break;
+
+    case BLE_ADVERT_TILT:
+      if (isDuplicateAdvert(advert, mac, uuidToTiltColor(view.mfg + 4)))
+        return;
+
+      Log.notice(F("BLE : Advertised iBeacon TILT Device: %s" CR),
+                 address.toString().c_str());
+      color = proccesTiltBeacon(view.mfg, view.mfgLength, advert.rssi,
+                                advert.timestamp);
+      if (color != TiltColor::None) getTiltData(color).address = address;
+      break;
+
+    case BLE_ADVERT_GRAVITYMON_IBEACON:
+      if (isDuplicateAdvert(advert, mac, TiltColor::None)) return;
+
+      Log.notice(F("BLE : Advertised iBeacon GRAVMON Device: %s" CR),
+                 address.toString().c_str());
+      proccesGravitymonBeacon(view.mfg, address, advert.timestamp);
+      break;
+  }
 }
 
 void BleClientCallbacks::onConnect(NimBLEClient* client) {
   // Log.notice(F("BLE : Client connected"));
 }
 
-void BleScanner::proccesGravitymonBeacon(const std::string& advertStringHex,
-                                         NimBLEAddress address) {
-  const char* payload = advertStringHex.c_str();
-
-  float battery;
-  float temp;
-  float gravity;
-  float angle;
-  uint32_t chipId;
-
-  chipId = (*(payload + 12) << 24) | (*(payload + 13) << 16) |
-           (*(payload + 14) << 8) | *(payload + 15);
-  angle = static_cast<float>((*(payload + 16) << 8) | *(payload + 17)) / 100;
-  battery = static_cast<float>((*(payload + 18) << 8) | *(payload + 19)) / 1000;
-  gravity =
-      static_cast<float>((*(payload + 20) << 8) | *(payload + 21)) / 10000;
-  temp = static_cast<float>((*(payload + 22) << 8) | *(payload + 23)) / 1000;
+void BleClientCallbacks::onDisconnect(NimBLEClient* client) {
+  bleScanner.onClientDisconnect(client);
+}
 
-  char chip[20];
-  snprintf(&chip[0], sizeof(chip), "%6x", chipId);
+void BleScanner::proccesGravitymonBeacon(const uint8_t* payload,
+                                         NimBLEAddress address,
+                                         uint64_t timestamp) {
+  uint32_t chipId = readUint32(payload + 12);
 
-  int idx = findGravitymonId(chip);
+  // The beacon values have the same scale as the stored fixed point values
+  int idx = findGravitymonId(chipId);
   if (idx >= 0) {
+    _gravitymon.setMac(idx, static_cast<uint64_t>(address));
     GravitymonData& data = getGravitymonData(idx);
-    data.tempC = temp;
-    data.gravity = gravity;
-    data.angle = angle;
-    data.battery = battery;
-    data.id = chip;
+    data.angleRaw = readUint16(payload + 16);
+    data.batteryRaw = readUint16(payload + 18);
+    data.gravityRaw = readUint16(payload + 20);
+    data.tempRaw = readUint16(payload + 22);
     data.address = address;
-    data.type = "Beacon";
-    data.setUpdated();
+    data.source = GRAVITYMON_SOURCE_BEACON;
+    data.setUpdated(timestamp);
   } else {
     Log.error(F("BLE : Max devices reached - no more devices available." CR));
   }
 }
 
 void BleScanner::processGravitymonEddystoneBeacon(NimBLEAddress address,
-                                                  const uint8_t* payload) {
+                                                  const uint8_t* payload,
+                                                  size_t length,
+                                                  uint64_t timestamp) {
   //                                                                      <--------------
   //                                                                      beacon
   //                                                                      data
   //                                                                      ------------>
   // 0b 09 67 72 61 76 69 74 79 6d 6f 6e 02 01 06 03 03 aa fe 11 16 aa fe 20 00
   // 0c 8b 10 8b 00 00 30 39 00 00 16 2e
+  //
+  // The payload is the service data after the uuid (20 00 0c 8b ...)
 
-  payload = payload + 23;
-
-  float battery;
-  float temp;
-  float gravity;
-  float angle;
-  uint32_t chipId;
-
-  battery = static_cast<float>((*(payload + 2) << 8) | *(payload + 3)) / 1000;
-  temp = static_cast<float>((*(payload + 4) << 8) | *(payload + 5)) / 1000;
-  gravity = static_cast<float>((*(payload + 6) << 8) | *(payload + 7)) / 10000;
-  angle = static_cast<float>((*(payload + 8) << 8) | *(payload + 9)) / 100;
-  chipId = (*(payload + 10) << 24) | (*(payload + 11) << 16) |
-           (*(payload + 12) << 8) | *(payload + 13);
+  if (length < 14) {
+    Log.error(F("BLE : Eddy stone beacon is too short." CR));
+    return;
+  }
 
-  char chip[20];
-  snprintf(&chip[0], sizeof(chip), "%6x", chipId);
+  uint32_t chipId = readUint32(payload + 10);
 
-  int idx = findGravitymonId(chip);
+  int idx = findGravitymonId(chipId);
   if (idx >= 0) {
+    _gravitymon.setMac(idx, static_cast<uint64_t>(address));
     GravitymonData& data = getGravitymonData(idx);
-    data.tempC = temp;
-    data.gravity = gravity;
-    data.angle = angle;
-    data.battery = battery;
-    data.id = chip;
+    data.batteryRaw = readUint16(payload + 2);
+    data.tempRaw = readUint16(payload + 4);
+    data.gravityRaw = readUint16(payload + 6);
+    data.angleRaw = readUint16(payload + 8);
 
     data.address = address;
-    data.type = "EddyStone";
-    data.setUpdated();
+    data.source = GRAVITYMON_SOURCE_EDDYSTONE;
+    data.setUpdated(timestamp);
   } else {
     Log.error(F("BLE : Max devices reached - no more devices available." CR));
   }
 }
 
 void BleScanner::processGravitymonExtBeacon(NimBLEAddress address,
-                                            const std::string& payload) {
+                                            const uint8_t* payload,
+                                            size_t length,
+                                            uint64_t timestamp) {
   // Log.notice(F("BLE : Advertised gravitymon ext device: %s" CR),
   //            address.toString().c_str());
 
-  DynamicJsonDocument in(1000);
-  DeserializationError err = deserializeJson(in, payload.c_str());
+  GravitymonReading reading;
 
-  if (err) {
-    Log.error(F("BLE : Failed to parse advertisement json %d" CR), err);
+  if (!parseGravitymonReading(reinterpret_cast<const char*>(payload), length,
+                              reading)) {
+    Log.error(F("BLE : Failed to parse advertisement json" CR));
     return;
   }
 
-  int idx = findGravitymonId(in[PARAM_BLE_ID].as<String>());
+  updateGravitymonData(address, reading, timestamp);
+}
+
+void BleScanner::updateGravitymonData(NimBLEAddress address,
+                                      const GravitymonReading& reading,
+                                      uint64_t timestamp) {
+  int idx = findGravitymonId(&reading.id[0]);
   if (idx >= 0) {
+    _gravitymon.setMac(idx, static_cast<uint64_t>(address));
     GravitymonData& data = getGravitymonData(idx);
-    data.tempC = in[PARAM_BLE_TEMP_UNITS].as<String>() == "C"
-                     ? in[PARAM_BLE_TEMP].as<float>()
-                     : convertFtoC(in[PARAM_BLE_TEMP].as<float>());
-    data.gravity = in[PARAM_BLE_GRAVITY].as<float>();
-    data.angle = in[PARAM_BLE_ANGLE].as<float>();
-    data.battery = in[PARAM_BLE_BATTERY].as<int>();
-    data.id = in[PARAM_BLE_ID].as<String>();
-
-    data.rssi = in[PARAM_BLE_RSSI].as<int>();
-    data.name = in[PARAM_BLE_NAME].as<String>();
-    data.token = in[PARAM_BLE_TOKEN].as<String>();
-    data.interval = in[PARAM_BLE_INTERVAL].as<int>();
+    data.setValues(reading.gravity,
+                   !strcmp(&reading.tempUnits[0], "C")
+                       ? reading.temp
+                       : convertFtoC(reading.temp),
+                   reading.angle, reading.battery);
+    if (!data.id[0]) strlcpy(&data.id[0], &reading.id[0], sizeof(data.id));
+
+    data.rssi = reading.rssi;
+    strlcpy(&data.name[0], &reading.name[0], sizeof(data.name));
+    strlcpy(&data.token[0], &reading.token[0], sizeof(data.token));
+    data.setInterval(reading.interval);
 
     data.address = address;
-    data.type = "ExtBeacon";
-    data.setUpdated();
+    data.source = GRAVITYMON_SOURCE_EXT_BEACON;
+    data.setUpdated(timestamp);
   } else {
     Log.error(F("BLE : Max devices reached - no more devices available." CR));
   }
@@ -240,13 +462,266 @@ void BleScanner::processGravitymonExtBeacon(NimBLEAddress address,
 void BleScanner::processGravitymonDevice(NimBLEAddress address) {
   // Log.notice(F("BLE : Advertised gravitymon device: %s" CR),
   //            address.toString().c_str());
-  _doConnect.push(address);
+
+  // Scanning is continuous so the same device will be seen many times before
+  // we connect to it.
+  if (isConnectPending(address)) return;
+
+  _doConnect.push_back(address);
 }
 
-bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
-  // Log.notice(F("BLE : Connecting to gravitymon device: %s" CR),
-  //            address.toString().c_str());
+bool BleScanner::isConnectPending(NimBLEAddress address) {
+  for (auto& a : _doConnect)
+    if (a == address) return true;
+
+  for (auto& job : _connectJobs)
+    if (job.state.load(std::memory_order_acquire) != CONNECT_IDLE &&
+        job.address == address)
+      return true;
+
+  BleNotifySession* session = findNotifySession(address);
+  if (session && session->state.load() == SESSION_CONNECTED) return true;
+
+  uint64_t mac = static_cast<uint64_t>(address);
+
+  for (auto& b : _connectBackoff)
+    if (b.mac == mac)
+      return static_cast<int32_t>(b.retryTime - millis()) > 0;
+
+  return false;
+}
+
+void BleScanner::updateConnectBackoff(uint64_t mac, bool success) {
+  BleConnectBackoff* slot = nullptr;
+
+  for (auto& b : _connectBackoff) {
+    if (b.mac == mac) {
+      slot = &b;
+      break;
+    }
+  }
+
+  if (success) {
+    if (slot) *slot = BleConnectBackoff();
+    return;
+  }
+
+  if (!slot) {
+    // Reuse a free entry or the one that has been allowed to retry longest
+    slot = &_connectBackoff[0];
+    for (auto& b : _connectBackoff) {
+      if (!b.mac) {
+        slot = &b;
+        break;
+      }
+      if (static_cast<int32_t>(b.retryTime - slot->retryTime) < 0) slot = &b;
+    }
+    *slot = BleConnectBackoff();
+    slot->mac = mac;
+  }
+
+  if (slot->failures < 16) slot->failures++;
+
+  uint32_t wait = BLE_CONNECT_BACKOFF_MIN;
+  for (int i = 1; i < slot->failures && wait < BLE_CONNECT_BACKOFF_MAX; i++)
+    wait *= 2;
+  if (wait > BLE_CONNECT_BACKOFF_MAX) wait = BLE_CONNECT_BACKOFF_MAX;
+
+  slot->retryTime = millis() + wait;
+  Log.notice(F("BLE : Connect failed %d times, retry in %d s." CR),
+             slot->failures, wait / 1000);
+}
+
+void BleScanner::connectTask(void* param) {
+  BleConnectJob* job = static_cast<BleConnectJob*>(param);
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    bool success = bleScanner.connectGravitymonDevice(
+        job->address, job->handle, job->reading, job->session);
+
+    // A session that was not started can be reused
+    uint8_t expected = SESSION_CONNECTING;
+    if (job->session && job->session->state.compare_exchange_strong(
+                            expected, SESSION_DISCONNECTED))
+      job->session->publish();
+
+    job->state.store(success ? CONNECT_SUCCESS : CONNECT_FAILED,
+                     std::memory_order_release);
+  }
+}
+
+// Collect the result of finished jobs and hand out queued devices to idle
+// workers. Returns the number of jobs still running.
+int BleScanner::serviceConnectJobs() {
+  int running = 0;
+
+  for (auto& job : _connectJobs) {
+    uint8_t state = job.state.load(std::memory_order_acquire);
+
+    if (state == CONNECT_RUNNING) {
+      running++;
+    } else if (state != CONNECT_IDLE) {
+      if (state == CONNECT_SUCCESS) {
+        updateGravitymonData(job.address, job.reading, getTimestamp());
+
+        int idx = findGravitymonMac(job.address);
+        if (idx >= 0) getGravitymonData(idx).valueHandle = job.handle;
+      }
+
+      updateConnectBackoff(static_cast<uint64_t>(job.address),
+                           state == CONNECT_SUCCESS);
+      job.state.store(CONNECT_IDLE, std::memory_order_relaxed);
+    }
+  }
+
+  // Notify sessions keep their link. A job started without a free link fails
+  // in connectClient() and puts a healthy device in backoff.
+  int links = running;
+  for (auto& session : _sessions)
+    if (session.state.load() == SESSION_CONNECTED) links++;
+
+  for (auto& job : _connectJobs) {
+    if (!_connectRound || links >= NIMBLE_MAX_CONNECTIONS) break;
+    if (!job.task || job.state.load(std::memory_order_acquire) != CONNECT_IDLE)
+      continue;
+
+    // Devices that got a notify session since they were queued
+    while (!_doConnect.empty()) {
+      BleNotifySession* session = findNotifySession(_doConnect.front());
+      if (!session || session->state.load() != SESSION_CONNECTED) break;
+      _doConnect.pop_front();
+    }
+
+    if (_doConnect.empty()) break;
+
+    job.address = _doConnect.front();
+    _doConnect.pop_front();
+
+    int idx = findGravitymonMac(job.address);
+    job.handle = idx >= 0 ? getGravitymonData(idx).valueHandle : 0;
+    job.session = nullptr;
+
+    if (_notifyMode && (idx < 0 || !getGravitymonData(idx).notifyUnsupported))
+      job.session = allocNotifySession(job.address);
+
+    job.state.store(CONNECT_RUNNING, std::memory_order_release);
+    xTaskNotifyGive(job.task);
+    running++;
+    links++;
+  }
+
+  return running;
+}
+
+BleNotifySession* BleScanner::findNotifySession(NimBLEAddress address) {
+  if (!_notifyMode) return nullptr;
+
+  for (auto& session : _sessions)
+    if (session.state.load() != SESSION_FREE && session.address == address)
+      return &session;
+
+  return nullptr;
+}
+
+// Returns the session for the device, a free or dropped session is used for
+// new devices. Returns nullptr when all sessions are in use.
+BleNotifySession* BleScanner::allocNotifySession(NimBLEAddress address) {
+  BleNotifySession* found = findNotifySession(address);
+
+  if (!found) {
+    for (auto& session : _sessions) {
+      uint8_t state = session.state.load();
+      if (state == SESSION_FREE) {
+        found = &session;
+        break;
+      }
+      if (state == SESSION_DISCONNECTED && !found) found = &session;
+    }
+
+    if (!found) return nullptr;
+
+    found->address = address;
+    found->connects = 0;
+    found->notifications = 0;
+    found->startTime = millis();
+  }
+
+  found->connects++;
+  found->setState(SESSION_CONNECTING);
+  return found;
+}
+
+void BleScanner::onClientDisconnect(NimBLEClient* client) {
+  for (auto& session : _sessions) {
+    if (session.state.load(std::memory_order_acquire) == SESSION_CONNECTED &&
+        session.client == client) {
+      session.client = nullptr;
+      session.setState(SESSION_DISCONNECTED);
+      Log.notice(F("BLE : Notify session with %s disconnected." CR),
+                 session.address.toString().c_str());
+    }
+  }
+}
+
+// Handle data pushed by the sessions and sessions that could not be set up
+void BleScanner::serviceNotifySessions() {
+  for (auto& session : _sessions) {
+    if (session.pending.load(std::memory_order_acquire)) {
+      GravitymonReading reading;
 
+      if (parseGravitymonReading(&session.data[0], session.length, reading))
+        updateGravitymonData(session.address, reading, getTimestamp());
+      else
+        Log.error(F("BLE : Failed to parse notification json" CR));
+
+      session.pending.store(false, std::memory_order_release);
+    }
+
+    if (session.state.load(std::memory_order_acquire) == SESSION_UNSUPPORTED) {
+      int idx = findGravitymonMac(session.address);
+      if (idx >= 0) getGravitymonData(idx).notifyUnsupported = true;
+      session.setState(SESSION_FREE);
+    }
+  }
+}
+
+// Runs in the connect worker, keeps the connection open and lets the device
+// push new readings.
+bool BleScanner::startNotifySession(NimBLEClient* client,
+                                    NimBLERemoteCharacteristic* chr,
+                                    BleNotifySession* session) {
+  auto onNotify = [session](NimBLERemoteCharacteristic* chr, uint8_t* data,
+                            size_t length, bool isNotify) {
+    session->notifications++;
+    session->publish();
+
+    // Drop the data if the main loop has not handled the previous one
+    if (session->pending.load(std::memory_order_acquire) ||
+        length > sizeof(session->data))
+      return;
+
+    memcpy(&session->data[0], data, length);
+    session->length = length;
+    session->pending.store(true, std::memory_order_release);
+  };
+
+  if (!chr->canNotify() || !chr->subscribe(true, onNotify)) return false;
+
+  session->client = client;
+  session->setState(SESSION_CONNECTED);
+
+  // Slow interval with slave latency so an idle link costs little air time,
+  // 400 * 1.25ms = 500ms interval, latency 4, 1000 * 10ms = 10s timeout.
+  client->updateConnParams(400, 400, 4, 1000);
+
+  Log.notice(F("BLE : Notify session with %s started." CR),
+             session->address.toString().c_str());
+  return true;
+}
+
+NimBLEClient* BleScanner::connectClient(NimBLEAddress address) {
   NimBLEClient* client = nullptr;
 
   if (NimBLEDevice::getClientListSize()) {
@@ -254,7 +729,7 @@ bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
     if (client) {
       if (!client->connect(address, false)) {
         Log.warning(F("BLE : Reconnect failed." CR));
-        return false;
+        return nullptr;
       }
       // Log.notice(F("BLE : Reconnected with client." CR));
     } else {
@@ -266,7 +741,7 @@ bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
     if (NimBLEDevice::getClientListSize() >= NIMBLE_MAX_CONNECTIONS) {
       Log.error(
           F("BLE : Max clients reached - no more connections available" CR));
-      return false;
+      return nullptr;
     }
 
     client = NimBLEDevice::createClient();
@@ -284,20 +759,102 @@ bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
     if (!client->connect(address)) {
       NimBLEDevice::deleteClient(client);
       Log.warning(F("BLE : Failed to connect, deleted client." CR));
-      return false;
+      return nullptr;
     }
   }
 
   if (!client->isConnected()) {
     if (!client->connect(address)) {
       Log.warning(F("BLE : Failed to connect." CR));
-      return false;
+      return nullptr;
     }
   }
 
+  return client;
+}
+
+struct BleReadContext {
+  TaskHandle_t task;
+  char* buffer;
+  size_t size;
+  size_t length;
+  int status;
+};
+
+// Called from the NimBLE host task for each part of a long read
+static int onReadValue(uint16_t connHandle, const ble_gatt_error* error,
+                       ble_gatt_attr* attr, void* arg) {
+  BleReadContext* ctx = static_cast<BleReadContext*>(arg);
+
+  if (error->status == 0 && attr) {
+    uint16_t len = os_mbuf_len(attr->om);
+
+    if (ctx->length + len > ctx->size) {
+      ctx->status = BLE_HS_ENOMEM;
+      xTaskNotifyGive(ctx->task);
+      return BLE_HS_ENOMEM;  // Aborts the read
+    }
+
+    os_mbuf_copydata(attr->om, 0, len, ctx->buffer + ctx->length);
+    ctx->length += len;
+    return 0;
+  }
+
+  ctx->status = error->status == BLE_HS_EDONE ? 0 : error->status;
+  xTaskNotifyGive(ctx->task);
+  return 0;
+}
+
+// Read the value of the attribute handle without doing service discovery
+static bool readHandle(NimBLEClient* client, uint16_t handle, char* buffer,
+                       size_t size, size_t* length) {
+  BleReadContext ctx = {xTaskGetCurrentTaskHandle(), buffer, size, 0, 0};
+
+  if (ble_gattc_read_long(client->getConnId(), handle, 0, onReadValue, &ctx))
+    return false;
+
+  // The stack always completes the procedure, with an error on timeout or
+  // disconnect.
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  *length = ctx.length;
+  return ctx.status == 0;
+}
+
+bool BleScanner::connectGravitymonDevice(NimBLEAddress address,
+                                         uint16_t& handle,
+                                         GravitymonReading& reading,
+                                         BleNotifySession* session) {
+  // Log.notice(F("BLE : Connecting to gravitymon device: %s" CR),
+  //            address.toString().c_str());
+
+  // The controller can only establish one connection at a time, so only the
+  // connect is serialized. Service discovery and reads run in parallel.
+  xSemaphoreTake(_connectLock, portMAX_DELAY);
+  NimBLEClient* client = connectClient(address);
+  xSemaphoreGive(_connectLock);
+
+  if (!client) return false;
+
   // Log.notice(F("BLE : Connected to: %s, RSSI: %d" CR),
   //            client->getPeerAddress().toString().c_str(), client->getRssi());
 
+  char data[BLE_GATT_VALUE_MAX];
+  size_t length = 0;
+
+  // Read the handle found on an earlier connection, if the device has changed
+  // the read or parsing fails and we fall back to discovery. A notify session
+  // needs the discovered characteristic to subscribe.
+  if (handle && !session &&
+      readHandle(client, handle, &data[0], sizeof(data), &length) &&
+      parseGravitymonReading(&data[0], length, reading)) {
+    // Log.notice(F("BLE : Done reading data from gravitymon device!" CR));
+    client->disconnect();
+    return true;
+  }
+
+  handle = 0;
+
   NimBLERemoteService* srv = nullptr;
   NimBLERemoteCharacteristic* chr = nullptr;
 
@@ -307,42 +864,28 @@ bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
     chr = srv->getCharacteristic(CHAR_UUID);
 
     if (chr && chr->canRead()) {
-      String data = chr->readValue();
-      // Log.notice(F("uuid=%s, value=%s" CR),
-      // chr->getUUID().toString().c_str(),
-      //            data.c_str());
-
-      DynamicJsonDocument in(1000);
-      DeserializationError err = deserializeJson(in, data.c_str());
+      if (!readHandle(client, chr->getHandle(), &data[0], sizeof(data),
+                      &length)) {
+        client->disconnect();
+        Log.warning(F("BLE : Failed to read characteristic %s!" CR),
+                    CHAR_UUID);
+        return false;
+      }
+      // Log.notice(F("uuid=%s, value=%.*s" CR),
+      // chr->getUUID().toString().c_str(), length, &data[0]);
 
-      if (err) {
+      if (!parseGravitymonReading(&data[0], length, reading)) {
         client->disconnect();
-        Log.error(F("BLE : Failed to parse advertisement json %d" CR), err);
+        Log.error(F("BLE : Failed to parse advertisement json" CR));
         return false;
       }
 
-      int idx = findGravitymonId(in["ID"].as<String>());
-      if (idx >= 0) {
-        GravitymonData& data = getGravitymonData(idx);
-        data.tempC = in["temp_units"].as<String>() == "C"
-                         ? in["temperature"].as<float>()
-                         : convertCtoF(in["temperature"].as<float>());
-        data.gravity = in["gravity"].as<float>();
-        data.angle = in["angle"].as<float>();
-        data.battery = in["battery"].as<int>();
-        data.id = in["ID"].as<String>();
-
-        data.rssi = in["RSSI"].as<int>();
-        data.name = in["name"].as<String>();
-        data.token = in["token"].as<String>();
-        data.interval = in["interval"].as<int>();
-
-        data.address = address;
-        data.type = "ExtBeacon";
-        data.setUpdated();
-      } else {
-        Log.error(
-            F("BLE : Max devices reached - no more devices available." CR));
+      handle = chr->getHandle();
+
+      if (session) {
+        if (startNotifySession(client, chr, session)) return true;
+
+        session->setState(SESSION_UNSUPPORTED);
       }
     } else {
       client->disconnect();
@@ -363,27 +906,55 @@ bool BleScanner::connectGravitymonDevice(NimBLEAddress address) {
 }
 
 BleScanner::BleScanner() {
+  _acceptListAdverts[0] = _acceptListAdverts[1] = 0;
   _deviceCallbacks = new BleDeviceCallbacks();
   _clientCallbacks = new BleClientCallbacks();
 }
 
 void BleScanner::init() {
+  Log.notice(F("BLE : Allocated room for %d devices." CR),
+             _gravitymon.init(_deviceCapacity));
+
+  if (!_connectLock) {
+    _connectLock = xSemaphoreCreateMutex();
+
+    for (auto& job : _connectJobs) {
+      if (xTaskCreate(connectTask, "ble_connect", BLE_CONNECT_STACK_SIZE, &job,
+                      1, &job.task) != pdPASS) {
+        Log.error(F("BLE : Failed to create connect task." CR));
+        job.task = nullptr;
+      }
+    }
+  }
+
   NimBLEDevice::init("");
   _bleScan = NimBLEDevice::getScan();
   _bleScan->setAdvertisedDeviceCallbacks(_deviceCallbacks);
   _bleScan->setMaxResults(0);
-  _bleScan->setActiveScan(_activeScan);
+#if CONFIG_BT_NIMBLE_EXT_ADV
+  // Coded PHY gives longer range at the cost of more air time per advert
+  _bleScan->setPhy(_codedPhy ? SCAN_ALL : SCAN_1M);
+  Log.notice(F("BLE : Receiving extended adverts on %s." CR),
+             _codedPhy ? "1M and coded PHY" : "1M PHY");
+#endif
+  _bleScan->setActiveScan(false);
+  _bleScan->setDuplicateFilter(
+      false);  // We scan continuously and want every advertisement
 
   _bleScan->setInterval(
       97);  // Select prime numbers to reduce risk of frequency beat pattern
             // with ibeacon advertisement interval
   _bleScan->setWindow(37);  // Set to less or equal setInterval value. Leave
                             // reasonable gap to allow WiFi some time.
+
+  // With adaptive scanning the radio is free most of the time, so use a wider
+  // window to not miss devices during the short scans.
+  if (_adaptiveScan) _bleScan->setWindow(79);
   scan();
 }
 
 void BleScanner::deInit() {
-  waitForScan();
+  if (_bleScan) _bleScan->stop();
   NimBLEDevice::deinit();
 }
 
@@ -392,161 +963,298 @@ bool BleScanner::scan() {
 
   if (_bleScan->isScanning()) return true;
 
-  _bleScan->clearResults();
+  if (_adaptiveScan)
+    Log.verbose(F("BLE : Starting %s scan window." CR),
+                _scanActiveNow ? "ACTIVE" : "PASSIVE");
+  else
+    Log.notice(F("BLE : Starting continuous %s scan." CR),
+               _scanActiveNow ? "ACTIVE" : "PASSIVE");
+  _bleScan->setActiveScan(_scanActiveNow);
+
+  // A duration of 0 will scan until stopped
+  if (_bleScan->start(0, nullptr, false)) {
+    if (!_scanStart) _scanStart = getTimestamp();
+    return true;
+  }
 
-  // Mark all tilt data as invalid
-  for (int i = 0; i < NO_TILT_COLORS; i++) {
-    _tilt[i].updated = false;
+  Log.error(F("BLE : Scan failed to start." CR));
+  return false;
+}
+
+void BleScanner::stopScan() {
+  _bleScan->stop();
+
+  if (_scanStart) {
+    _scanTimeTotal += getTimestamp() - _scanStart;
+    _scanStart = 0;
   }
+}
+
+uint32_t BleScanner::getScanDuty() {
+  uint64_t now = getTimestamp();
+  uint64_t total = _scanTimeTotal;
+
+  if (_scanStart) total += now - _scanStart;
+  return now ? total * 100 / now : 0;
+}
+
+// A push slot is open when no connections are running and, with adaptive
+// scanning, no scan window is needed. With continuous scanning any time is
+// as good as another.
+bool BleScanner::isPushSlotOpen() {
+  return !_connectRound && (!_adaptiveScan || !isScanNeeded());
+}
 
-  // Mark all gravitymon data as invalid
-  for (int i = 0; i < NO_GRAVITYMON; i++) {
-    _gravitymon[i].updated = false;
+void BleScanner::beginPushSlot(uint32_t waitTime) {
+  _pushSlotStart = millis();
+  _pushSlotWait += waitTime;
+}
+
+void BleScanner::endPushSlot(int pushes) {
+  uint32_t time = millis() - _pushSlotStart;
+
+  _pushSlotCount++;
+  _pushSlotPushes += pushes;
+  _pushSlotTime += time;
+
+  Log.info(F("BLE : Push slot with %d pushes took %d ms." CR), pushes, time);
+}
+
+// Scanning is passive, when devices that could have their name in the scan
+// response show up an active scan is done once to classify them.
+void BleScanner::serviceScanMode() {
+  uint32_t now = millis();
+
+  if (_scanActiveNow) {
+    if (now - _activeWindowStart < static_cast<uint32_t>(_scanTime * 1000))
+      return;
+  } else if (!_activeScan || !_macUnknown.load() ||
+             (_activeWindows && now - _activeWindowStart < BLE_ACTIVE_PERIOD)) {
+    return;
   }
 
-  Log.notice(F("BLE : Starting %s scan." CR),
-             _activeScan ? "ACTIVE" : "PASSIVE");
-  _bleScan->setActiveScan(_activeScan);
+  if (_connectRound) return;
 
-  if (_bleScan->start(_scanTime, nullptr, true)) {
-    return true;
+  if (_bleScan->isScanning()) stopScan();
+
+  _scanActiveNow = !_scanActiveNow;
+  _macUnknown = 0;
+
+  if (_scanActiveNow) {
+    _activeWindowStart = now;
+    _activeWindows++;
   }
 
-  Log.error(F("BLE : Scan failed to start." CR));
-  return false;
+  Log.verbose(F("BLE : Switching to %s scan." CR),
+              _scanActiveNow ? "ACTIVE" : "PASSIVE");
 }
 
-bool BleScanner::waitForScan() {
-  if (!_bleScan) return false;
+// Discovery sweep for new devices, tilts and devices we lost track of, one
+// scan time every discovery period.
+bool BleScanner::isDiscoveryWindow() {
+  uint32_t now = millis();
+
+  if (!_lastDiscovery || now - _lastDiscovery > BLE_DISCOVERY_PERIOD)
+    _lastDiscovery = now;
 
-  while (_bleScan->isScanning()) {
-    delay(100);
+  return now - _lastDiscovery < static_cast<uint32_t>(_scanTime * 1000);
+}
+
+// Program the controller accept list with the devices we know, only possible
+// when the scan is stopped. Returns false if the list could not be used.
+bool BleScanner::updateAcceptList() {
+  NimBLEAddress known[BLE_ACCEPT_LIST_MAX];
+  size_t count = 0;
+
+  for (int i = 0; i < getGravitymonCount(); i++) {
+    GravitymonData& data = getGravitymonData(i);
+    if (!data.mac) continue;
+    if (count >= BLE_ACCEPT_LIST_MAX) return false;
+    known[count++] = data.address;
   }
 
-  while (!_doConnect.empty()) {
-    uint32_t start = millis();
-    connectGravitymonDevice(_doConnect.front());
-    _doConnect.pop();
-    Log.info(F("Connected with devices, took %d ms" CR), millis() - start);
+  for (int i = 0; i < NO_TILT_COLORS; i++) {
+    TiltData& data = getTiltData(static_cast<TiltColor>(i));
+    if (!data.timeUpdated) continue;
+    if (count >= BLE_ACCEPT_LIST_MAX) return false;
+    known[count++] = data.address;
+  }
+
+  if (!count) return false;
+
+  // Remove devices that are gone, the list shifts when removing
+  for (size_t i = NimBLEDevice::getWhiteListCount(); i > 0; i--) {
+    NimBLEAddress address = NimBLEDevice::getWhiteListAddress(i - 1);
+    bool found = false;
+
+    for (size_t j = 0; j < count && !found; j++) found = known[j] == address;
+
+    if (!found) NimBLEDevice::whiteListRemove(address);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (!NimBLEDevice::onWhiteList(known[i]) &&
+        !NimBLEDevice::whiteListAdd(known[i])) {
+      Log.warning(F("BLE : Failed to add %s to accept list." CR),
+                  known[i].toString().c_str());
+      return false;
+    }
   }
 
   return true;
 }
 
-TiltColor BleScanner::proccesTiltBeacon(const std::string& advertStringHex,
-                                        const int8_t& currentRSSI) {
-  TiltColor color;
+// Switch between the open discovery window and only receiving adverts from
+// known devices. Changing the filter requires the scan to be restarted.
+void BleScanner::serviceAcceptList() {
+  bool wanted = _acceptList && !isDiscoveryWindow();
 
-  // Check that this is an iBeacon packet
-  if (advertStringHex[0] != 0x4c || advertStringHex[1] != 0x00 ||
-      advertStringHex[2] != 0x02 || advertStringHex[3] != 0x15)
-    return TiltColor::None;
+  if (wanted == _acceptListWanted || _connectRound) return;
 
-  // The advertisement string is the "manufacturer data" part of the following:
-  // Advertised Device: Name: Tilt, Address: 88:c2:55:ac:26:81, manufacturer
-  // data: 4c000215a495bb40c5b14b44b5121370f02d74de005004d9c5
-  // 4c000215a495bb40c5b14b44b5121370f02d74de005004d9c5
-  // ????????iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiittttggggXR
-  // **********----------**********----------**********
-  char hexCode[3] = {'\0'};
-  char colorArray[33] = {'\0'};
-  char tempArray[5] = {'\0'};
-  char gravityArray[5] = {'\0'};
-  char txPowerArray[3] = {'\0'};
-
-  for (int i = 4; i < advertStringHex.length(); i++) {
-    snprintf(hexCode, sizeof(hexCode), "%.2x", advertStringHex[i]);
-    // Indices 4 - 19 each generate two characters of the color array
-    if ((i > 3) && (i < 20)) {
-      strncat(colorArray, hexCode, 2);
-    }
-    // Indices 20-21 each generate two characters of thfe temperature array
-    if (i == 20 || i == 21) {
-      strncat(tempArray, hexCode, 2);
-    }
-    // Indices 22-23 each generate two characters of the sp_gravity array
-    if (i == 22 || i == 23) {
-      strncat(gravityArray, hexCode, 2);
-    }
-    // Index 24 contains the tx_pwr (which is used by recent tilts to indicate
-    // battery age)
-    if (i == 24) {
-      strncat(txPowerArray, hexCode, 2);
-    }
+  if (_bleScan->isScanning()) stopScan();
+
+  bool active = wanted && updateAcceptList();
+  uint32_t now = millis();
+
+  if (_acceptListStart)
+    _acceptListTime[_acceptListActive.load()] += now - _acceptListStart;
+  _acceptListStart = now;
+
+  _bleScan->setFilterPolicy(active ? BLE_HCI_SCAN_FILT_USE_WL
+                                   : BLE_HCI_SCAN_FILT_NO_WL);
+  _acceptListActive.store(active);
+  _acceptListWanted = wanted;
+
+  Log.verbose(F("BLE : Accept list %s with %d devices." CR),
+              active ? "active" : "inactive",
+              NimBLEDevice::getWhiteListCount());
+}
+
+float BleScanner::getAdvertRate(bool filtered) {
+  uint32_t time = _acceptListTime[filtered];
+
+  if (_acceptListStart && _acceptListActive.load() == filtered)
+    time += millis() - _acceptListStart;
+
+  return time ? _acceptListAdverts[filtered].load() * 1000.0 / time : 0;
+}
+
+float BleScanner::getHostCpuSaved() {
+  float saved = (getAdvertRate(false) - getAdvertRate(true)) *
+                getCallbackTime();  // us per second
+
+  return saved > 0 && getAdvertRate(true) > 0 ? saved / 10000 : 0;
+}
+
+bool BleScanner::isScanNeeded() {
+  if (!_adaptiveScan) return true;
+
+  if (isDiscoveryWindow()) return true;
+
+  uint64_t now = getTimestamp();
+
+  // Scan from just before a device is expected until it has been seen, give
+  // up after one scan time if it's missing.
+  for (int i = 0; i < getGravitymonCount(); i++) {
+    GravitymonData& data = getGravitymonData(i);
+
+    if (!data.period) continue;
+
+    BleNotifySession* session = findNotifySession(data.address);
+    if (session && session->state.load() == SESSION_CONNECTED) continue;
+
+    uint32_t phase = (now - data.arrivalTime) % data.period;
+    bool seen = now - data.timeUpdated <= phase;
+
+    if (data.period - phase < BLE_ARRIVAL_GUARD) return true;
+    if (!seen &&
+        phase < static_cast<uint32_t>(BLE_ARRIVAL_GUARD + _scanTime * 1000))
+      return true;
   }
 
-  color = uuidToTiltColor(colorArray);
-  if (color == TiltColor::None) {
-    return TiltColor::None;
+  return false;
+}
+
+void BleScanner::loop() {
+  if (!_bleScan) return;
+
+  BleAdvert* advert;
+
+  while ((advert = _advertQueue.peek()) != nullptr) {
+    processAdvert(*advert);
+    _advertQueue.release();
+  }
+
+  // Connecting to a device will stop the scan, so only start a round of
+  // connections once per scan time period. The workers do the GATT reads and
+  // the scan is resumed when the round is done.
+  if (!_connectRound && !_doConnect.empty() &&
+      (millis() - _lastConnectRun) > static_cast<uint32_t>(_scanTime * 1000)) {
+    _connectRound = true;
+    _connectRoundStart = millis();
+  }
+
+  serviceNotifySessions();
+
+  if (!serviceConnectJobs() && _connectRound) {
+    Log.info(F("Connected with devices, took %d ms" CR),
+             millis() - _connectRoundStart);
+    _connectRound = false;
+    _lastConnectRun = millis();
   }
 
-  uint16_t temp = std::strtoul(tempArray, nullptr, 16);
-  uint16_t gravity = std::strtoul(gravityArray, nullptr, 16);
-  uint8_t txPower = std::strtoul(txPowerArray, nullptr, 16);
+  if (_acceptList) serviceAcceptList();
+  serviceScanMode();
+
+  if (_scanPaused) {
+    // Radio is used for a TLS handshake
+    if (_bleScan->isScanning()) stopScan();
+  } else if (_connectRound) {
+    // Connecting stops the scan, keep the scan time in sync
+    if (_scanStart && !_bleScan->isScanning()) stopScan();
+  } else if (isScanNeeded()) {
+    if (!_bleScan->isScanning()) scan();
+  } else if (_bleScan->isScanning()) {
+    stopScan();
+  }
+}
 
-  float gravityFactor = 1000;
-  float tempFactor = 1;
+TiltColor BleScanner::proccesTiltBeacon(const uint8_t* payload, size_t length,
+                                        int8_t currentRSSI,
+                                        uint64_t timestamp) {
+  TiltBeacon beacon;
 
-  if (gravity >= 5000) {  // check for tilt PRO
-    gravityFactor = 10000;
-    tempFactor = 10;
+  if (!decodeTiltBeacon(payload, length, &beacon)) return TiltColor::None;
+
+  TiltColor color = uuidToTiltColor(payload + 4);
+  if (color == TiltColor::None) {
+    return TiltColor::None;
   }
 
   // Log.notice(
   //     F("BLE : Tilt data received Temp=%sF, SG=%s, TxPower=%d, Pro=%s" CR),
-  //     String(temp / tempFactor, 1).c_str(),
-  //     String(gravity / gravityFactor, 4).c_str(), txPower,
-  //     gravity >= 5000 ? "yes" : "no");
+  //     String(beacon.getTempF(), 1).c_str(),
+  //     String(beacon.getGravity(), 4).c_str(), beacon.txPower,
+  //     beacon.isPro() ? "yes" : "no");
 
   TiltData& data = getTiltData(color);
-  data.gravity = gravity / gravityFactor;
-  data.tempF = temp / tempFactor;
-  data.txPower = txPower;
+  data.gravity = beacon.getGravity();
+  data.tempF = beacon.getTempF();
+  data.txPower = beacon.txPower;
   data.rssi = currentRSSI;
-  data.setUpdated();
+  data.setUpdated(timestamp);
   return color;
 }
 
-TiltColor BleScanner::uuidToTiltColor(std::string uuid) {
-  if (uuid == TILT_COLOR_RED_UUID) {
-    return TiltColor::Red;
-  } else if (uuid == TILT_COLOR_GREEN_UUID) {
-    return TiltColor::Green;
-  } else if (uuid == TILT_COLOR_BLACK_UUID) {
-    return TiltColor::Black;
-  } else if (uuid == TILT_COLOR_PURPLE_UUID) {
-    return TiltColor::Purple;
-  } else if (uuid == TILT_COLOR_ORANGE_UUID) {
-    return TiltColor::Orange;
-  } else if (uuid == TILT_COLOR_BLUE_UUID) {
-    return TiltColor::Blue;
-  } else if (uuid == TILT_COLOR_YELLOW_UUID) {
-    return TiltColor::Yellow;
-  } else if (uuid == TILT_COLOR_PINK_UUID) {
-    return TiltColor::Pink;
-  }
-  return TiltColor::None;
-}
-
-const char* BleScanner::getTiltColorAsString(TiltColor col) {
-  if (col == TiltColor::Red) {
-    return "Red";
-  } else if (col == TiltColor::Green) {
-    return "Green";
-  } else if (col == TiltColor::Black) {
-    return "Black";
-  } else if (col == TiltColor::Purple) {
-    return "Purple";
-  } else if (col == TiltColor::Orange) {
-    return "Orange";
-  } else if (col == TiltColor::Blue) {
-    return "Blue";
-  } else if (col == TiltColor::Yellow) {
-    return "Yellow";
-  } else if (col == TiltColor::Pink) {
-    return "Pink";
-  }
-  return "";
+TiltColor BleScanner::uuidToTiltColor(const uint8_t* uuid) {
+  // The colors only differ in the high nibble of the fourth byte (1-8)
+  int idx = (uuid[3] >> 4) - 1;
+
+  if (idx < 0 || idx >= NO_TILT_COLORS ||
+      memcmp(uuid, &TILT_COLOR_UUID[idx][0], sizeof(TILT_COLOR_UUID[idx])))
+    return TiltColor::None;
+
+  return static_cast<TiltColor>(idx);
 }
 
 // EOF
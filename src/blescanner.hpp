@@ -27,7 +27,6 @@ SOFTWARE.
 #ifndef SRC_BLESCANNER_HPP_
 #define SRC_BLESCANNER_HPP_
 
-#include <ArduinoJson.h>
 #include <ArduinoLog.h>
 
 #undef LOG_LEVEL_ERROR
@@ -37,21 +36,83 @@ SOFTWARE.
 #include <NimBLEDevice.h>
 #include <NimBLEScan.h>
 #include <NimBLEUtils.h>
-
-#include <queue>
+#include <math.h>
+
+#include <atomic>
+#include <deque>
+#include <deviceregistry.hpp>
+#include <reading.hpp>
+#include <ringbuffer.hpp>
+#include <seqlock.hpp>
 #include <string>
+#include <timebase.hpp>
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+constexpr auto BLE_ADVERT_MAX_PAYLOAD =
+    255;  // Extended advertisement, room for a full json reading
+#else
+constexpr auto BLE_ADVERT_MAX_PAYLOAD =
+    62;  // Legacy advertisement and scan response (2 * 31 bytes)
+#endif
+constexpr auto BLE_ADVERT_QUEUE_SIZE =
+    32;  // Number of raw adverts that can wait for processing
+
+constexpr auto BLE_ADVERT_CACHE_SIZE =
+    32;  // Number of devices to remember the last advert for
+
+constexpr auto BLE_MAC_CLASS_SIZE =
+    64;  // Number of devices to remember the classification for
+constexpr auto BLE_ACTIVE_PERIOD =
+    60000;  // ms, min time between active scans for unknown devices
+
+enum BleAdvertKind : uint8_t {
+  BLE_ADVERT_NONE = 0,
+  BLE_ADVERT_GRAVITYMON_EDDYSTONE = 1,
+  BLE_ADVERT_GRAVITYMON_EXT = 2,
+  BLE_ADVERT_GRAVITYMON_DEVICE = 3,
+  BLE_ADVERT_TILT = 4,
+  BLE_ADVERT_GRAVITYMON_IBEACON = 5
+};
+
+// Pointers into the raw advert for the AD structures we use, service data
+// points to the data after the uuid.
+struct BleAdvertView {
+  const uint8_t *name;
+  const uint8_t *mfg;
+  const uint8_t *eddystone;
+  const uint8_t *serv;
+  const uint8_t *serv2;
+  uint8_t nameLength;
+  uint8_t mfgLength;
+  uint8_t eddystoneLength;
+  uint8_t servLength;
+  uint8_t serv2Length;
+};
 
-constexpr auto PARAM_BLE_ID = "ID";
-constexpr auto PARAM_BLE_TEMP = "temp";
-constexpr auto PARAM_BLE_TEMPERATURE = "temperature";
-constexpr auto PARAM_BLE_GRAVITY = "gravity";
-constexpr auto PARAM_BLE_ANGLE = "angle";
-constexpr auto PARAM_BLE_BATTERY = "battery";
-constexpr auto PARAM_BLE_RSSI = "RSSI";
-constexpr auto PARAM_BLE_NAME = "name";
-constexpr auto PARAM_BLE_TOKEN = "token";
-constexpr auto PARAM_BLE_INTERVAL = "interval";
-constexpr auto PARAM_BLE_TEMP_UNITS = "temp_units";
+// Raw advertisement copied by the scan callback, decoded in the main loop
+struct BleAdvert {
+  uint64_t timestamp;  // When it was received, the reading time
+  uint8_t mac[6];
+  uint8_t addressType;
+  int8_t rssi;
+  uint8_t length;
+  BleAdvertKind kind;
+  bool extended;
+  bool coded;
+  uint8_t payload[BLE_ADVERT_MAX_PAYLOAD];
+};
+
+// What a device turned out to be, BLE_ADVERT_NONE for foreign devices
+struct BleMacClass {
+  uint64_t mac = 0;
+  BleAdvertKind kind = BLE_ADVERT_NONE;
+};
+
+// Hash of the last advert seen from a device, used to skip decoding of repeats
+struct BleAdvertCacheEntry {
+  uint64_t mac = 0;
+  uint32_t hash = 0;
+};
 
 class BleDeviceCallbacks : public NimBLEAdvertisedDeviceCallbacks {
   void onResult(NimBLEAdvertisedDevice *advertisedDevice) override;
@@ -59,6 +120,7 @@ class BleDeviceCallbacks : public NimBLEAdvertisedDeviceCallbacks {
 
 class BleClientCallbacks : public NimBLEClientCallbacks {
   void onConnect(NimBLEClient *pClient) override;
+  void onDisconnect(NimBLEClient *pClient) override;
 };
 
 enum TiltColor {
@@ -82,68 +144,297 @@ class TiltData {
   int rssi = 0;
 
   // Internal stuff
+  NimBLEAddress address;
   bool updated = false;
-  struct tm timeinfoUpdated;
-  uint32_t timeUpdated = 0;
-  uint32_t timePushed = 0;
+  uint64_t timeUpdated = 0;
+  uint64_t timePushed = 0;
 
-  void setUpdated() {
+  void setUpdated(uint64_t timestamp = getTimestamp()) {
     updated = true;
-    timeUpdated = millis();
-    getLocalTime(&timeinfoUpdated);
+    timeUpdated = timestamp;
   }
 
   void setPushed() {
     updated = false;
-    timePushed = millis();
+    timePushed = getTimestamp();
   }
 
-  uint32_t getUpdateAge() { return (millis() - timeUpdated) / 1000; }
-  uint32_t getPushAge() { return (millis() - timePushed) / 1000; }
+  uint32_t getUpdateAge() { return (getTimestamp() - timeUpdated) / 1000; }
+  uint32_t getPushAge() { return (getTimestamp() - timePushed) / 1000; }
 };
 
-class GravitymonData {
- public:
-  // Data points
-  float tempC = 0;
-  float gravity = 0;
-  float angle = 0;
-  float battery = 0;
-  int txPower = 0;
-  int rssi = 0;
-  String id = "";
-  String name = "";
-  String token = "";
-  int interval = 0;
+// Adverts closer than this belong to the same wake up of a device
+constexpr auto BLE_BURST_GAP = 5000;  // ms
 
-  // Internal stuff
-  NimBLEAddress address;
-  String type = "";
-  String data = "";
+// Copy of the device data for readers in other tasks, like the web server
+struct GravitymonSnapshot {
+  char id[GRAVITYMON_ID_SIZE];
+  float gravity;
+  float tempC;
+  uint64_t timeUpdated;
+  uint64_t timePushed;
+
+  uint32_t getUpdateAge() const {
+    return (getTimestamp() - timeUpdated) / 1000;
+  }
+  uint32_t getPushAge() const { return (getTimestamp() - timePushed) / 1000; }
+};
+
+enum GravitymonSource : uint8_t {
+  GRAVITYMON_SOURCE_NONE = 0,
+  GRAVITYMON_SOURCE_BEACON = 1,
+  GRAVITYMON_SOURCE_EDDYSTONE = 2,
+  GRAVITYMON_SOURCE_EXT_BEACON = 3,
+  GRAVITYMON_SOURCE_HTTP = 4,
+};
+
+// Values are stored as fixed point with the resolution of the beacons
+constexpr auto GRAVITYMON_GRAVITY_SCALE = 10000;
+constexpr auto GRAVITYMON_TEMP_SCALE = 1000;
+constexpr auto GRAVITYMON_ANGLE_SCALE = 100;
+constexpr auto GRAVITYMON_BATTERY_SCALE = 1000;
+
+inline int32_t toFixed(float value, int scale) {
+  return lroundf(value * scale);
+}
+
+// Fixed size record without heap allocations. The fields used when scanning
+// the whole table (push due, registry lookups, eviction) are kept in the
+// first 32 bytes, which is one cache line when the table is in PSRAM.
+class alignas(32) GravitymonData {
+ public:
+  // Hot fields
+  uint64_t timeUpdated = 0;
+  uint64_t timePushed = 0;
+  uint64_t mac = 0;
+  uint32_t chipId = 0;
+  uint16_t interval = 0;  // s
   bool updated = false;
-  struct tm timeinfoUpdated;
-  uint32_t timeUpdated = 0;
-  uint32_t timePushed = 0;
+  GravitymonSource source = GRAVITYMON_SOURCE_NONE;
+
+  // Learned reporting period and start of the last burst of adverts
+  uint64_t arrivalTime = 0;
+  uint32_t period = 0;
+
+  // Data points, see the scales above
+  int32_t gravityRaw = 0;
+  int32_t tempRaw = 0;  // C
+  int32_t angleRaw = 0;
+  uint16_t batteryRaw = 0;
+  int8_t rssi = 0;
+
+  // Cold fields
+  bool notifyUnsupported = false;
+  uint16_t valueHandle = 0;  // GATT handle of the value, 0 until discovered
+  NimBLEAddress address;
+  char id[GRAVITYMON_ID_SIZE] = "";
+  bool hashedId = false;  // Chip id is a hash of the id string
+  char name[33] = "";
+  char token[65] = "";
+
+  // Published each time the device is updated or pushed
+  Seqlock<GravitymonSnapshot> snapshot;
+
+  float getGravity() const {
+    return static_cast<float>(gravityRaw) / GRAVITYMON_GRAVITY_SCALE;
+  }
+  float getTempC() const {
+    return static_cast<float>(tempRaw) / GRAVITYMON_TEMP_SCALE;
+  }
+  float getAngle() const {
+    return static_cast<float>(angleRaw) / GRAVITYMON_ANGLE_SCALE;
+  }
+  float getBattery() const {
+    return static_cast<float>(batteryRaw) / GRAVITYMON_BATTERY_SCALE;
+  }
+
+  void setValues(float gravity, float tempC, float angle, float battery) {
+    gravityRaw = toFixed(gravity, GRAVITYMON_GRAVITY_SCALE);
+    tempRaw = toFixed(tempC, GRAVITYMON_TEMP_SCALE);
+    angleRaw = toFixed(angle, GRAVITYMON_ANGLE_SCALE);
+    batteryRaw = toFixed(battery, GRAVITYMON_BATTERY_SCALE);
+  }
+
+  void setInterval(int seconds) {
+    interval = seconds < 0 ? 0 : seconds > UINT16_MAX ? UINT16_MAX : seconds;
+  }
+
+  void setUpdated(uint64_t now = getTimestamp()) {
+    if (now < timeUpdated) now = timeUpdated;  // Older than the last update
+
+    if (!arrivalTime || now - timeUpdated > BLE_BURST_GAP) {
+      updateArrival(now);
+    }
 
-  void setUpdated() {
     updated = true;
-    timeUpdated = millis();
-    getLocalTime(&timeinfoUpdated);
+    timeUpdated = now;
+    publish();
   }
 
   void setPushed() {
     updated = false;
-    timePushed = millis();
+    timePushed = getTimestamp();
+    publish();
   }
 
-  uint32_t getUpdateAge() { return (millis() - timeUpdated) / 1000; }
-  uint32_t getPushAge() { return (millis() - timePushed) / 1000; }
+  void publish() {
+    GravitymonSnapshot s;
+
+    strlcpy(&s.id[0], getId(), sizeof(s.id));
+    s.gravity = getGravity();
+    s.tempC = getTempC();
+    s.timeUpdated = timeUpdated;
+    s.timePushed = timePushed;
+    snapshot.write(s);
+  }
+
+  uint32_t getUpdateAge() { return (getTimestamp() - timeUpdated) / 1000; }
+  uint32_t getPushAge() { return (getTimestamp() - timePushed) / 1000; }
+
+  // Seconds since the device should have reported, based on its interval
+  int32_t getSilentTime() {
+    return static_cast<int32_t>(getUpdateAge()) - interval;
+  }
+
+  void updateArrival(uint64_t now) {
+    uint64_t since = arrivalTime ? now - arrivalTime : 0;
+    uint32_t gap = since > UINT32_MAX ? UINT32_MAX : since;
+    uint32_t expected = period ? period : interval * 1000;
+
+    // Bursts we did not scan for make the gap a multiple of the period
+    if (gap && expected) {
+      uint32_t n = (gap + expected / 2) / expected;
+      if (n > 1 && gap / n > BLE_BURST_GAP) gap /= n;
+    }
+
+    if (gap) period = period ? (period * 3 + gap) / 4 : gap;
+    arrivalTime = now;
+  }
+
+  // Beacons only send the chip id, format it first time it's needed
+  const char *getId() {
+    if (!id[0]) snprintf(&id[0], sizeof(id), "%6x", chipId);
+    return &id[0];
+  }
+
+  const char *getSourceName() const {
+    switch (source) {
+      case GRAVITYMON_SOURCE_BEACON:
+        return "Beacon";
+      case GRAVITYMON_SOURCE_EDDYSTONE:
+        return "EddyStone";
+      case GRAVITYMON_SOURCE_EXT_BEACON:
+        return "ExtBeacon";
+      case GRAVITYMON_SOURCE_HTTP:
+        return "Http";
+      default:
+        return "";
+    }
+  }
 };
 
 const auto NO_TILT_COLORS =
     8;  // Number of tilt devices that can be managed (one per color)
-const auto NO_GRAVITYMON =
-    8;  // Number of gravitymon devices that can be handled
+
+constexpr const char *TILT_COLOR_NAMES[NO_TILT_COLORS] = {
+    "Red", "Green", "Black", "Purple", "Orange", "Blue", "Yellow", "Pink"};
+
+// Connect mode devices are read by worker tasks, one per possible connection
+constexpr auto BLE_CONNECT_STACK_SIZE = 4096;
+constexpr auto BLE_GATT_VALUE_MAX = 512;  // Max length of an attribute value
+constexpr auto BLE_CONNECT_BACKOFF_SIZE = 16;
+constexpr auto BLE_CONNECT_BACKOFF_MIN = 10000;   // ms
+constexpr auto BLE_CONNECT_BACKOFF_MAX = 600000;  // ms
+
+enum BleConnectState : uint8_t {
+  CONNECT_IDLE = 0,
+  CONNECT_RUNNING = 1,
+  CONNECT_SUCCESS = 2,
+  CONNECT_FAILED = 3
+};
+
+// In notify mode connect mode devices are kept connected and push their data,
+// one link is left for polling devices that don't fit.
+constexpr auto BLE_NOTIFY_SESSIONS =
+    NIMBLE_MAX_CONNECTIONS > 1 ? NIMBLE_MAX_CONNECTIONS - 1 : 1;
+
+enum BleSessionState : uint8_t {
+  SESSION_FREE = 0,
+  SESSION_CONNECTING = 1,
+  SESSION_CONNECTED = 2,
+  SESSION_DISCONNECTED = 3,
+  SESSION_UNSUPPORTED = 4
+};
+
+// Copy of the session for the web server, published on every change
+struct BleSessionSnapshot {
+  uint64_t mac;
+  uint8_t state;
+  uint32_t connects;
+  uint32_t startTime;
+  uint32_t notifications;
+
+  uint32_t getReconnects() const { return connects > 1 ? connects - 1 : 0; }
+  float getNotifyRate() const {  // Notifications per hour
+    uint32_t time = millis() - startTime;
+    return time ? notifications * 3600000.0 / time : 0;
+  }
+};
+
+struct BleNotifySession {
+  NimBLEAddress address;
+  NimBLEClient *client = nullptr;
+  std::atomic<uint8_t> state{SESSION_FREE};
+  uint32_t connects = 0;
+  uint32_t startTime = 0;
+  std::atomic<uint32_t> notifications{0};
+
+  // Last notification, owned by the NimBLE task until pending is set
+  std::atomic<bool> pending{false};
+  uint16_t length = 0;
+  char data[BLE_GATT_VALUE_MAX];
+
+  Seqlock<BleSessionSnapshot> snapshot;
+
+  void setState(uint8_t s) {
+    state.store(s, std::memory_order_release);
+    publish();
+  }
+
+  void publish() {
+    BleSessionSnapshot s;
+
+    s.mac = static_cast<uint64_t>(address);
+    s.state = state.load(std::memory_order_acquire);
+    s.connects = connects;
+    s.startTime = startTime;
+    s.notifications = notifications.load();
+    snapshot.write(s);
+  }
+};
+
+struct BleConnectJob {
+  TaskHandle_t task = nullptr;
+  NimBLEAddress address;
+  uint16_t handle = 0;
+  BleNotifySession *session = nullptr;
+  GravitymonReading reading;
+  std::atomic<uint8_t> state{CONNECT_IDLE};
+};
+
+struct BleConnectBackoff {
+  uint64_t mac = 0;
+  uint8_t failures = 0;
+  uint32_t retryTime = 0;
+};
+
+// Adaptive scanning, scan around the expected arrival of known devices and
+// do a discovery sweep for new devices once in a while.
+constexpr auto BLE_DISCOVERY_PERIOD = 60000;  // ms
+constexpr auto BLE_ARRIVAL_GUARD = 2000;      // ms
+
+// Size of the accept list in the controller (CONFIG_BTDM_BLE_WHITELIST_SIZE)
+constexpr auto BLE_ACCEPT_LIST_MAX = 12;
 
 class BleScanner {
  public:
@@ -152,50 +443,179 @@ class BleScanner {
   void deInit();
 
   bool scan();
-  bool waitForScan();
+  void loop();
+
+  void queueAdvert(NimBLEAdvertisedDevice *advertisedDevice);
+  uint32_t getAdvertOverflow() { return _advertQueue.getOverflow(); }
+  uint32_t getAdvertHighWater() { return _advertQueue.getHighWater(); }
+  uint32_t getAdvertCacheHits() { return _advertCacheHits; }
+  uint32_t getAdvertCacheMisses() { return _advertCacheMisses; }
+  uint32_t getAdvertsIgnored() { return _advertsIgnored; }
+  uint32_t getExtendedAdverts() { return _extendedAdverts; }
+  uint32_t getCodedAdverts() { return _codedAdverts; }
 
   void setScanTime(int scanTime) { _scanTime = scanTime; }
+  // Allow active scans for devices that only have their name in the scan
+  // response, scanning is passive otherwise
   void setAllowActiveScan(bool activeScan) { _activeScan = activeScan; }
+  uint32_t getActiveWindows() { return _activeWindows; }
+  uint32_t getMacClassified() { return _macClassified; }
+  void setDeviceCapacity(int capacity) { _deviceCapacity = capacity; }
+  void setNotifyMode(bool notify) { _notifyMode = notify; }
+  void setAdaptiveScan(bool adaptive) { _adaptiveScan = adaptive; }
+  void setCodedPhy(bool coded) { _codedPhy = coded; }
+  void setAcceptList(bool acceptList) { _acceptList = acceptList; }
+
+  // Host task load from adverts, with the accept list active and inactive
+  uint32_t getCallbackTime() {  // Average us per advert callback
+    uint32_t count = _callbackCount.load();
+    return count ? _callbackTime.load() / count : 0;
+  }
+  float getAdvertRate(bool filtered);  // Adverts per second
+  float getHostCpuSaved();             // Percent of one core
+  uint32_t getScanDuty();  // Percent of time spent scanning
+
+  // Radio slots for pushing data over WiFi, scanning goes on in the slot
+  // except while paused for a TLS handshake
+  bool isPushSlotOpen();
+  void beginPushSlot(uint32_t waitTime);
+  void endPushSlot(int pushes);
+  uint32_t getPushSlotCount() { return _pushSlotCount; }
+  uint32_t getPushSlotPushes() { return _pushSlotPushes; }
+  uint32_t getPushSlotTime() {  // Average ms per slot
+    return _pushSlotCount ? _pushSlotTime / _pushSlotCount : 0;
+  }
+  uint32_t getPushSlotWait() {  // Average ms from push due to slot
+    return _pushSlotCount ? _pushSlotWait / _pushSlotCount : 0;
+  }
+  void pauseScan(bool pause) { _scanPaused = pause; }
 
-  TiltColor proccesTiltBeacon(const std::string &advertStringHex,
-                              const int8_t &currentRSSI);
-  void proccesGravitymonBeacon(const std::string &advertStringHex,
-                               NimBLEAddress address);
+  void onClientDisconnect(NimBLEClient *client);
+  void getNotifySessionSnapshot(int idx, BleSessionSnapshot &s) {
+    _sessions[idx].snapshot.read(s);
+  }
+  int getNotifySessionCount() { return _notifyMode ? BLE_NOTIFY_SESSIONS : 0; }
+
+  // The timestamp is when the advert was received
+  TiltColor proccesTiltBeacon(const uint8_t *payload, size_t length,
+                              int8_t currentRSSI, uint64_t timestamp);
+  void proccesGravitymonBeacon(const uint8_t *payload, NimBLEAddress address,
+                               uint64_t timestamp);
 
   void processGravitymonDevice(NimBLEAddress address);
   void processGravitymonEddystoneBeacon(NimBLEAddress address,
-                                        const uint8_t *payload);
+                                        const uint8_t *payload, size_t length,
+                                        uint64_t timestamp);
   void processGravitymonExtBeacon(NimBLEAddress address,
-                                  const std::string &payload);
+                                  const uint8_t *payload, size_t length,
+                                  uint64_t timestamp);
 
   TiltData &getTiltData(TiltColor col) { return _tilt[col]; }
-  int findGravitymonId(String id) {
-    for (int i = 0; i < NO_GRAVITYMON; i++)
-      if (_gravitymon[i].id == id || _gravitymon[i].id == "") return i;
-    return -1;
+  int findGravitymonId(uint32_t chipId) {
+    return _gravitymon.findOrAdd(chipId);
+  }
+  int findGravitymonId(const char *id) { return _gravitymon.findOrAdd(id); }
+  int findGravitymonMac(NimBLEAddress address) {
+    return _gravitymon.findByMac(static_cast<uint64_t>(address));
   }
-  GravitymonData &getGravitymonData(int idx) { return _gravitymon[idx]; }
+  GravitymonData &getGravitymonData(int idx) { return _gravitymon.get(idx); }
+  void getGravitymonSnapshot(int idx, GravitymonSnapshot &s) {
+    _gravitymon.get(idx).snapshot.read(s);
+  }
+  int getGravitymonCount() { return _gravitymon.size(); }
+  int getGravitymonCapacity() { return _gravitymon.capacity(); }
+  uint32_t getGravitymonEvictions() { return _gravitymon.getEvictions(); }
 
-  const char *getTiltColorAsString(TiltColor col);
+  const char *getTiltColorAsString(TiltColor col) {
+    return (col >= 0 && col < NO_TILT_COLORS) ? TILT_COLOR_NAMES[col] : "";
+  }
 
  private:
   int _scanTime = 5;
   bool _activeScan = false;
+  std::atomic<bool> _scanActiveNow{false};
+  uint32_t _activeWindowStart = 0;
+  uint32_t _activeWindows = 0;
+  BleMacClass _macClass[BLE_MAC_CLASS_SIZE];  // Used by the NimBLE task
+  std::atomic<uint32_t> _macClassified{0};
+  std::atomic<uint32_t> _macUnknown{0};
+  bool _notifyMode = false;
+  bool _adaptiveScan = false;
+  bool _codedPhy = false;
+  bool _acceptList = false;
+  bool _acceptListWanted = false;
+  std::atomic<bool> _acceptListActive{false};
+  uint32_t _acceptListStart = 0;
+  uint32_t _acceptListTime[2] = {0, 0};  // ms in open / filtered mode
+  std::atomic<uint32_t> _acceptListAdverts[2];
+  std::atomic<uint32_t> _callbackTime{0};
+  std::atomic<uint32_t> _callbackCount{0};
+  uint32_t _lastDiscovery = 0;
+  uint64_t _scanStart = 0;  // Timestamp, 0 when not scanning
+  uint64_t _scanTimeTotal = 0;
+  bool _scanPaused = false;
+  uint32_t _pushSlotStart = 0;
+  uint32_t _pushSlotCount = 0;
+  uint32_t _pushSlotPushes = 0;
+  uint64_t _pushSlotTime = 0;
+  uint64_t _pushSlotWait = 0;
+  int _deviceCapacity = 16;
 
   BLEScan *_bleScan = nullptr;
 
   BleDeviceCallbacks *_deviceCallbacks = nullptr;
   BleClientCallbacks *_clientCallbacks = nullptr;
 
+  RingBuffer<BleAdvert, BLE_ADVERT_QUEUE_SIZE> _advertQueue;
+  uint32_t _lastConnectRun = 0;
+
+  BleAdvertCacheEntry _advertCache[BLE_ADVERT_CACHE_SIZE];
+  uint32_t _advertCacheHits = 0;
+  uint32_t _advertCacheMisses = 0;
+  std::atomic<uint32_t> _advertsIgnored{0};  // Updated by the NimBLE task
+  uint32_t _extendedAdverts = 0;
+  uint32_t _codedAdverts = 0;
+
   // Tilt related data
   TiltData _tilt[NO_TILT_COLORS];
 
   // Gravitymon related data
-  GravitymonData _gravitymon[NO_GRAVITYMON];
-  std::queue<NimBLEAddress> _doConnect;
-
-  TiltColor uuidToTiltColor(std::string uuid);
-  bool connectGravitymonDevice(NimBLEAddress address);
+  DeviceRegistry<GravitymonData> _gravitymon;
+  std::deque<NimBLEAddress> _doConnect;
+  BleConnectJob _connectJobs[NIMBLE_MAX_CONNECTIONS];
+  BleConnectBackoff _connectBackoff[BLE_CONNECT_BACKOFF_SIZE];
+  SemaphoreHandle_t _connectLock = nullptr;
+  BleNotifySession _sessions[BLE_NOTIFY_SESSIONS];
+  bool _connectRound = false;
+  uint32_t _connectRoundStart = 0;
+
+  void queueAdvertData(NimBLEAdvertisedDevice *advertisedDevice);
+  bool isScanNeeded();
+  void serviceScanMode();
+  bool isDiscoveryWindow();
+  bool updateAcceptList();
+  void serviceAcceptList();
+  void stopScan();
+  void processAdvert(const BleAdvert &advert);
+  bool isDuplicateAdvert(const BleAdvert &advert, uint64_t mac,
+                         TiltColor color);
+  TiltColor uuidToTiltColor(const uint8_t *uuid);
+  static void connectTask(void *param);
+  int serviceConnectJobs();
+  void serviceNotifySessions();
+  BleNotifySession *findNotifySession(NimBLEAddress address);
+  BleNotifySession *allocNotifySession(NimBLEAddress address);
+  bool startNotifySession(NimBLEClient *client, NimBLERemoteCharacteristic *chr,
+                          BleNotifySession *session);
+  bool isConnectPending(NimBLEAddress address);
+  void updateConnectBackoff(uint64_t mac, bool success);
+  NimBLEClient *connectClient(NimBLEAddress address);
+  bool connectGravitymonDevice(NimBLEAddress address, uint16_t &handle,
+                               GravitymonReading &reading,
+                               BleNotifySession *session);
+  void updateGravitymonData(NimBLEAddress address,
+                            const GravitymonReading &reading,
+                            uint64_t timestamp);
 };
 
 extern BleScanner bleScanner;
@@ -41,7 +41,12 @@ void GravmonGatewayConfig::createJson(JsonObject& doc) {
   doc[PARAM_TIMEZONE] = getTimezone();
   doc[PARAM_BLE_ACTIVE_SCAN] = getBleActiveScan();
   doc[PARAM_BLE_SCAN_TIME] = getBleScanTime();
+  doc[PARAM_BLE_NOTIFY] = getBleNotify();
+  doc[PARAM_BLE_ADAPTIVE_SCAN] = getBleAdaptiveScan();
+  doc[PARAM_BLE_CODED_PHY] = getBleCodedPhy();
+  doc[PARAM_BLE_ACCEPT_LIST] = getBleAcceptList();
   doc[PARAM_PUSH_RESEND_TIME] = getPushResendTime();
+  doc[PARAM_DEVICE_CAPACITY] = getDeviceCapacity();
 }
 
 void GravmonGatewayConfig::parseJson(JsonObject& doc) {
@@ -62,8 +67,18 @@ void GravmonGatewayConfig::parseJson(JsonObject& doc) {
     setBleActiveScan(doc[PARAM_BLE_ACTIVE_SCAN].as<bool>());
   if (!doc[PARAM_BLE_SCAN_TIME].isNull())
     setBleScanTime(doc[PARAM_BLE_SCAN_TIME].as<int>());
+  if (!doc[PARAM_BLE_NOTIFY].isNull())
+    setBleNotify(doc[PARAM_BLE_NOTIFY].as<bool>());
+  if (!doc[PARAM_BLE_ADAPTIVE_SCAN].isNull())
+    setBleAdaptiveScan(doc[PARAM_BLE_ADAPTIVE_SCAN].as<bool>());
+  if (!doc[PARAM_BLE_CODED_PHY].isNull())
+    setBleCodedPhy(doc[PARAM_BLE_CODED_PHY].as<bool>());
+  if (!doc[PARAM_BLE_ACCEPT_LIST].isNull())
+    setBleAcceptList(doc[PARAM_BLE_ACCEPT_LIST].as<bool>());
   if (!doc[PARAM_PUSH_RESEND_TIME].isNull())
     setPushResendTime(doc[PARAM_PUSH_RESEND_TIME].as<int>());
+  if (!doc[PARAM_DEVICE_CAPACITY].isNull())
+    setDeviceCapacity(doc[PARAM_DEVICE_CAPACITY].as<int>());
 }
 
 // EOF
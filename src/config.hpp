@@ -27,6 +27,8 @@ SOFTWARE.
 #include <baseconfig.hpp>
 #include <utils.hpp>
 
+constexpr auto DEVICE_CAPACITY_MAX = 256;
+
 class GravmonGatewayConfig : public BaseConfig {
  private:
   int _configVersion = 2;
@@ -35,8 +37,13 @@ class GravmonGatewayConfig : public BaseConfig {
   char _gravityFormat = 'G';
   String _timezone = "";
   bool _bleActiveScan = false;
+  bool _bleNotify = false;
+  bool _bleAdaptiveScan = false;
+  bool _bleCodedPhy = false;
+  bool _bleAcceptList = false;
   int _bleScanTime = 5;
   int _pushResendTime = 300;
+  int _deviceCapacity = 16;
 
   // Other
   bool _darkMode = false;
@@ -72,12 +79,49 @@ class GravmonGatewayConfig : public BaseConfig {
     _saveNeeded = true;
   }
 
+  // Number of devices per source (BLE / HTTP), requires a restart to change
+  int getDeviceCapacity() { return _deviceCapacity; }
+  void setDeviceCapacity(int v) {
+    if (v >= 1 && v <= DEVICE_CAPACITY_MAX) {
+      _deviceCapacity = v;
+      _saveNeeded = true;
+    }
+  }
+
   bool getBleActiveScan() { return _bleActiveScan; }
   void setBleActiveScan(bool b) {
     _bleActiveScan = b;
     _saveNeeded = true;
   }
 
+  // Keep connect mode devices connected and let them notify new data
+  bool getBleNotify() { return _bleNotify; }
+  void setBleNotify(bool b) {
+    _bleNotify = b;
+    _saveNeeded = true;
+  }
+
+  // Only scan when devices are expected and for periodic discovery sweeps
+  bool getBleAdaptiveScan() { return _bleAdaptiveScan; }
+  void setBleAdaptiveScan(bool b) {
+    _bleAdaptiveScan = b;
+    _saveNeeded = true;
+  }
+
+  // Also scan on coded PHY, only used on builds with BLE 5 extended adverts
+  bool getBleCodedPhy() { return _bleCodedPhy; }
+  void setBleCodedPhy(bool b) {
+    _bleCodedPhy = b;
+    _saveNeeded = true;
+  }
+
+  // Only receive adverts from known devices outside the discovery window
+  bool getBleAcceptList() { return _bleAcceptList; }
+  void setBleAcceptList(bool b) {
+    _bleAcceptList = b;
+    _saveNeeded = true;
+  }
+
   char getGravityFormat() { return _gravityFormat; }
   void setGravityFormat(char c) {
     if (c == 'G' || c == 'P') {
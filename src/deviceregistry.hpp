@@ -0,0 +1,311 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_DEVICEREGISTRY_HPP_
+#define SRC_DEVICEREGISTRY_HPP_
+
+#include <Arduino.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+constexpr auto REGISTRY_STALE_INTERVALS = 3;  // Missed reports before evicting
+constexpr auto REGISTRY_STALE_MIN = 900;      // s, also when interval is 0
+
+// Convert a device id string to the chip id used as key. Gravitymon sends the
+// chip id as hex, anything else (or longer than 32 bits) is hashed (FNV-1a).
+// Hashed ids can collide so hashed is set to tell that the id string must be
+// compared as well.
+inline uint32_t deviceIdToChipId(const char *id, bool *hashed = nullptr) {
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(id, &end, 16);
+
+  if (hashed) *hashed = false;
+  if (*id && !*end && !errno && value <= UINT32_MAX) return value;
+
+  uint32_t chipId = 2166136261u;
+  while (*id) {
+    chipId ^= static_cast<uint8_t>(*id++);
+    chipId *= 16777619u;
+  }
+
+  if (hashed) *hashed = true;
+  return chipId;
+}
+
+// Device table indexed by chip id and mac address using open addressing hash
+// tables with linear probing. The storage is allocated once from a pool (PSRAM
+// when available) with a capacity set at runtime. Slots are handed out in
+// order and when the table is full the device that has been silent longest is
+// evicted and its slot reused.
+//
+// T must have the members chipId (uint32_t), mac (uint64_t, 0 when not known),
+// id (char array), hashedId (bool, chip id is a hash of id), updated (bool,
+// reading not pushed yet), interval (s) and getSilentTime() returning how
+// many seconds the device is overdue.
+template <typename T>
+class DeviceRegistry {
+ private:
+  static constexpr int16_t EMPTY = -1;
+
+  void *_storage = nullptr;  // Unaligned allocation holding the devices
+  T *_devices = nullptr;
+  int16_t *_chipIndex = nullptr;
+  int16_t *_macIndex = nullptr;
+  uint16_t _capacity = 0;
+  uint16_t _indexMask = 0;
+  uint16_t _count = 0;
+  uint32_t _evictions = 0;
+
+  uint16_t hash(uint32_t key) const {
+    return ((key * 2654435761u) >> 16) & _indexMask;
+  }
+  uint16_t hash(uint64_t key) const {
+    return hash(static_cast<uint32_t>(key ^ (key >> 32)));
+  }
+  uint16_t next(uint16_t h) const { return (h + 1) & _indexMask; }
+
+  // A hashed chip id only matches the device with the same id string
+  bool matches(const T &d, uint32_t chipId, const char *id) const {
+    if (d.chipId != chipId) return false;
+    if (!id) return !d.hashedId;
+    return d.hashedId && !strncmp(&d.id[0], id, sizeof(d.id) - 1);
+  }
+
+  static void *allocate(size_t size) {
+    void *p = nullptr;
+    if (psramFound()) p = ps_malloc(size);
+    if (!p) p = malloc(size);
+    return p;
+  }
+
+ public:
+  ~DeviceRegistry() { release(); }
+
+  // Allocate storage for the devices, the capacity is reduced if there is not
+  // enough memory. Returns the capacity that was allocated.
+  uint16_t init(uint16_t capacity) {
+    release();
+
+    while (capacity) {
+      uint16_t indexSize = 1;
+      while (indexSize < capacity * 2) indexSize <<= 1;
+
+      // Devices are aligned as declared by T, malloc only guarantees 8 bytes
+      _storage = allocate(sizeof(T) * capacity + alignof(T) - 1);
+      _devices = reinterpret_cast<T *>(
+          (reinterpret_cast<uintptr_t>(_storage) + alignof(T) - 1) &
+          ~static_cast<uintptr_t>(alignof(T) - 1));
+      _chipIndex =
+          static_cast<int16_t *>(allocate(sizeof(int16_t) * indexSize));
+      _macIndex =
+          static_cast<int16_t *>(allocate(sizeof(int16_t) * indexSize));
+
+      if (_storage && _chipIndex && _macIndex) {
+        for (int i = 0; i < capacity; i++) new (&_devices[i]) T();
+        for (int i = 0; i < indexSize; i++)
+          _chipIndex[i] = _macIndex[i] = EMPTY;
+        _capacity = capacity;
+        _indexMask = indexSize - 1;
+        return _capacity;
+      }
+
+      release();
+      capacity /= 2;
+    }
+
+    return 0;
+  }
+
+  void release() {
+    if (_devices) {
+      for (int i = 0; i < _capacity; i++) _devices[i].~T();
+    }
+    free(_storage);
+    free(_chipIndex);
+    free(_macIndex);
+    _storage = nullptr;
+    _devices = nullptr;
+    _chipIndex = _macIndex = nullptr;
+    _capacity = _count = _indexMask = 0;
+  }
+
+  // Returns the slot for the chip id or -1 if not registered. Id is the
+  // string the chip id was hashed from, nullptr for real chip ids.
+  int find(uint32_t chipId, const char *id = nullptr) const {
+    if (!_capacity) return -1;
+
+    for (uint16_t h = hash(chipId);; h = next(h)) {
+      int16_t idx = _chipIndex[h];
+      if (idx == EMPTY) return -1;
+      if (matches(_devices[idx], chipId, id)) return idx;
+    }
+  }
+
+  int find(const char *id) const {
+    bool hashed;
+    uint32_t chipId = deviceIdToChipId(id, &hashed);
+    return find(chipId, hashed ? id : nullptr);
+  }
+
+  // Returns the slot for the chip id, a new slot is allocated for unknown
+  // devices. Returns -1 when the registry is full and no device is overdue.
+  int findOrAdd(uint32_t chipId, const char *id = nullptr) {
+    if (!_capacity) return -1;
+
+    int idx = find(chipId, id);
+    if (idx >= 0) return idx;
+
+    if (_count < _capacity) {
+      idx = _count++;
+    } else {
+      idx = findStale();
+      if (idx < 0) return -1;
+
+      unlinkChipId(idx);
+      unlinkMac(idx);
+      _devices[idx] = T();
+      _evictions++;
+    }
+
+    _devices[idx].chipId = chipId;
+    if (id) {
+      _devices[idx].hashedId = true;
+      strlcpy(&_devices[idx].id[0], id, sizeof(_devices[idx].id));
+    }
+
+    uint16_t h = hash(chipId);
+    while (_chipIndex[h] != EMPTY) h = next(h);
+    _chipIndex[h] = idx;
+    return idx;
+  }
+
+  int findOrAdd(const char *id) {
+    bool hashed;
+    uint32_t chipId = deviceIdToChipId(id, &hashed);
+    return findOrAdd(chipId, hashed ? id : nullptr);
+  }
+
+  int findByMac(uint64_t mac) const {
+    if (!mac || !_capacity) return -1;
+
+    for (uint16_t h = hash(mac);; h = next(h)) {
+      int16_t idx = _macIndex[h];
+      if (idx == EMPTY) return -1;
+      if (_devices[idx].mac == mac) return idx;
+    }
+  }
+
+  // Register the mac address as a secondary key for the slot
+  void setMac(int idx, uint64_t mac) {
+    if (!mac || _devices[idx].mac == mac) return;
+
+    unlinkMac(idx);  // Device changed address
+
+    int old = findByMac(mac);
+    if (old >= 0) unlinkMac(old);  // Address moved to another device
+
+    _devices[idx].mac = mac;
+    uint16_t h = hash(mac);
+    while (_macIndex[h] != EMPTY) h = next(h);
+    _macIndex[h] = idx;
+  }
+
+  T &get(int idx) { return _devices[idx]; }
+  int size() const { return _count; }
+  int capacity() const { return _capacity; }
+  uint32_t getEvictions() const { return _evictions; }
+
+ private:
+  // The device that has been silent the longest compared to its own interval.
+  // A device must have missed a few reports to be evicted and one with a
+  // reading that has not been pushed is kept.
+  int findStale() {
+    int idx = -1;
+    int32_t silent = 0;
+
+    for (int i = 0; i < _count; i++) {
+      T &d = _devices[i];
+      if (d.updated) continue;
+
+      int32_t margin = d.interval * REGISTRY_STALE_INTERVALS;
+      if (margin < REGISTRY_STALE_MIN) margin = REGISTRY_STALE_MIN;
+
+      int32_t s = d.getSilentTime() - margin;
+      if (s > silent) {
+        silent = s;
+        idx = i;
+      }
+    }
+
+    return idx;
+  }
+
+  void unlinkChipId(int idx) {
+    for (uint16_t h = hash(_devices[idx].chipId);; h = next(h)) {
+      if (_chipIndex[h] == idx) {
+        removeIndex(_chipIndex, h, false);
+        break;
+      }
+    }
+  }
+
+  void unlinkMac(int idx) {
+    if (!_devices[idx].mac) return;
+
+    for (uint16_t h = hash(_devices[idx].mac);; h = next(h)) {
+      if (_macIndex[h] == idx) {
+        removeIndex(_macIndex, h, true);
+        break;
+      }
+    }
+    _devices[idx].mac = 0;
+  }
+
+  // Backward shift deletion so that probe sequences stay intact
+  void removeIndex(int16_t *index, uint16_t h, bool macKey) {
+    uint16_t n = next(h);
+
+    while (index[n] != EMPTY) {
+      const T &d = _devices[index[n]];
+      uint16_t home = macKey ? hash(d.mac) : hash(d.chipId);
+
+      // Move the entry if its home position is outside (h, n]
+      if (((n - home) & _indexMask) >= ((n - h) & _indexMask)) {
+        index[h] = index[n];
+        h = n;
+      }
+      n = next(n);
+    }
+
+    index[h] = EMPTY;
+  }
+};
+
+#endif  // SRC_DEVICEREGISTRY_HPP_
+
+// EOF
@@ -28,8 +28,10 @@ SOFTWARE.
 #include <led.hpp>
 #include <log.hpp>
 #include <main.hpp>
+#include <pushdispatcher.hpp>
 #include <pushtarget.hpp>
 #include <serialws.hpp>
+#include <tasks.hpp>
 #include <utils.hpp>
 #include <webserver.hpp>
 #include <wificonnection.hpp>
@@ -49,6 +51,9 @@ constexpr auto CFG_AP_PASS = "password";
 #endif
 
 void controller();
+void bleTask(void* param);
+bool isPushDue(GravitymonData& gmd);
+bool queuePush(GravitymonData& gmd, bool last);
 void renderDisplayHeader();
 void renderDisplayFooter();
 void renderDisplayLogs();
@@ -66,6 +71,17 @@ Display myDisplay;
 int interval = 1000;      // ms, time to wait between changes to output
 uint32_t loopMillis = 0;  // Used for main loop to run the code every _interval_
 RunMode runMode = RunMode::gatewayMode;
+constexpr auto PUSH_SLOT_MAX_WAIT = 10000;  // ms, max delay of a due push
+uint32_t pushDueTime = 0;  // When the first device became due for a push
+constexpr auto PUSH_SLOT_MAX_TIME = 2000;  // ms, to dispatch the slot
+int pushSlotPushes = 0;      // Pushes queued in the current push slot
+uint32_t pushSlotStart = 0;  // When the current push slot started
+
+// BLE ingest and pushing run in their own tasks, the Arduino loop handles the
+// web server and display.
+constexpr auto BLE_TASK_STACK = 6144;
+
+SemaphoreHandle_t logLock = nullptr;
 
 struct LogEntry {
   char s[60] = "";
@@ -77,6 +93,8 @@ int logIndex = 0;
 bool logUpdated = true;
 
 void setup() {
+  logLock = xSemaphoreCreateMutex();
+
   // Main startup
   Log.notice(F("Main: Started setup for %s." CR), myConfig.getID());
   printBuildOptions();
@@ -195,7 +213,22 @@ void setup() {
     Log.notice(F("Main: Initialize ble scanner." CR));
     bleScanner.setScanTime(myConfig.getBleScanTime());
     bleScanner.setAllowActiveScan(myConfig.getBleActiveScan());
+    bleScanner.setDeviceCapacity(myConfig.getDeviceCapacity());
+    bleScanner.setNotifyMode(myConfig.getBleNotify());
+    bleScanner.setAdaptiveScan(myConfig.getBleAdaptiveScan());
+    bleScanner.setCodedPhy(myConfig.getBleCodedPhy());
+    bleScanner.setAcceptList(myConfig.getBleAcceptList());
     bleScanner.init();
+    GravmonGatewayPush::loadTemplates();
+
+    TaskHandle_t task;
+
+    if (xTaskCreatePinnedToCore(bleTask, "ble", BLE_TASK_STACK, nullptr, 2,
+                                &task, TASK_CORE_BLE) == pdPASS)
+      myTasks.add(TASK_BLE, "ble", task, TASK_CORE_BLE);
+
+    if (!myPush.begin() || !myTasks.isActive(TASK_BLE))
+      Log.error(F("Main: Failed to create tasks." CR));
   }
 
   Log.notice(F("Main: Startup completed." CR));
@@ -208,9 +241,11 @@ void setup() {
   renderDisplayHeader();
   renderDisplayFooter();
   loopMillis = millis();
+  myTasks.add(TASK_LOOP, "loop", xTaskGetCurrentTaskHandle(), xPortGetCoreID());
 }
 
 void loop() {
+  myTasks.begin(TASK_LOOP);
   myUptime.calculate();
   myWebServer.loop();
   myWifi.loop();
@@ -223,7 +258,6 @@ void loop() {
         myWifi.connect();
         renderDisplayFooter();
       }
-      controller();
       break;
 
     case RunMode::wifiSetupMode:
@@ -231,16 +265,34 @@ void loop() {
   }
 
   if(logUpdated) {
+    xSemaphoreTake(logLock, portMAX_DELAY);
     renderDisplayLogs();
     logUpdated = false;
+    xSemaphoreGive(logLock);
   }
+
+  myTasks.end(TASK_LOOP);
 }
 
-void addLogEntry(const char* id, tm timeinfo, float gravitySG, float tempC) {
+void bleTask(void* param) {
+  while (true) {
+    myTasks.begin(TASK_BLE);
+    controller();
+    myTasks.end(TASK_BLE);
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+void addLogEntry(const char* id, uint64_t timestamp, float gravitySG,
+                 float tempC) {
+  tm timeinfo;
+  timestampToLocalTime(timestamp, &timeinfo);
+
   float temp = myConfig.isTempFormatF() ? convertCtoF(tempC) : tempC;
   float gravity =
       myConfig.isGravityPlato() ? convertToPlato(gravitySG) : gravitySG;
 
+  xSemaphoreTake(logLock, portMAX_DELAY);
   snprintf(&logEntryList[logIndex].s[0], sizeof(LogEntry::s),
            "%02d:%02d:%02d %s %.3F%s %.1F%s", timeinfo.tm_hour, timeinfo.tm_min,
            timeinfo.tm_sec, id, gravity, myConfig.isGravitySG() ? "SG" : "P",
@@ -249,12 +301,14 @@ void addLogEntry(const char* id, tm timeinfo, float gravitySG, float tempC) {
   if (++logIndex >= maxLogEntries) logIndex = 0;
 
   logUpdated = true;
+  xSemaphoreGive(logLock);
 }
 
 void controller() {
-  // Scan for ble beacons
-  bleScanner.scan();
-  bleScanner.waitForScan();
+  // Process ble beacons and http posts received since last loop
+  bleScanner.pauseScan(myPush.isHandshaking());
+  bleScanner.loop();
+  myWebServer.processReadings();
 
 #if defined(ENABLE_TILT_SCANNING)
   /*
@@ -262,11 +316,11 @@ void controller() {
    * as BLE transmission, will show detected tilt devices but dont send data.
    */
   for (int i = 0; i < NO_TILT_COLORS; i++) {
-    TiltData td = bleScanner.getTiltData((TiltColor)i);
+    TiltData& td = bleScanner.getTiltData((TiltColor)i);
 
     if (td.updated && (td.getPushAge() > myConfig.getPushResendTime())) {
       addLogEntry(bleScanner.getTiltColorAsString((TiltColor)i),
-                  td.timeinfoUpdated, td.gravity, convertFtoC(td.tempF));
+                  td.timeUpdated, td.gravity, convertFtoC(td.tempF));
 
       Log.notice(F("Main: Type=%s, Gravity=%F, Temp=%F "
                    "Id=%s." CR),
@@ -276,47 +330,105 @@ void controller() {
       /*
       push.sendAll(td.angle, td.gravity, td.tempC, td.battery, td.interval,
                   td.id.c_str(), td.token.c_str(), td.name.c_str());
-      td.setPushed();
       */
+      td.setPushed();
     }
   }
 #endif
 
-  GravmonGatewayPush push(&myConfig);
+  // The push slot ends when the dispatcher has handed the batch to the
+  // workers, the targets are not waited for. Scanning goes on during the slot
+  // and is only paused while a worker does a TLS handshake.
+  if (pushSlotPushes) {
+    if (myPush.getQueued() &&
+        (millis() - pushSlotStart) < PUSH_SLOT_MAX_TIME)
+      return;
+
+    bleScanner.endPushSlot(pushSlotPushes);
+    pushSlotPushes = 0;
+  }
+
+  // Wait for a gap between scan windows before pushing, all devices that are
+  // due are pushed in the same slot.
+  bool due = false;
+
+  for (int i = 0; i < bleScanner.getGravitymonCount() && !due; i++)
+    due = isPushDue(bleScanner.getGravitymonData(i));
+  for (int i = 0; i < myWebServer.getGravitymonCount() && !due; i++)
+    due = isPushDue(myWebServer.getGravitymonData(i));
+
+  if (!due) {
+    pushDueTime = 0;
+    return;
+  }
+
+  if (!pushDueTime) pushDueTime = millis();
+
+  if (!bleScanner.isPushSlotOpen() &&
+      (millis() - pushDueTime) < PUSH_SLOT_MAX_WAIT)
+    return;
+
+  bleScanner.beginPushSlot(millis() - pushDueTime);
+  pushSlotStart = millis();
+
+  // Collect the devices first so the last push of the slot can be marked,
+  // the queue is normally empty here so they fit. The rest go in the next
+  // slot.
+  GravitymonData* slot[PUSH_QUEUE_SIZE];
+  int count = 0;
 
   // Process gravitymon from BLE
-  for (int i = 0; i < NO_GRAVITYMON; i++) {
+  for (int i = 0; i < bleScanner.getGravitymonCount(); i++) {
     GravitymonData& gmd = bleScanner.getGravitymonData(i);
 
-    if (gmd.updated && (gmd.getPushAge() > myConfig.getPushResendTime())) {
-      addLogEntry(gmd.id.c_str(), gmd.timeinfoUpdated, gmd.gravity, gmd.tempC);
-
-      Log.notice(F("Main: Type=%s, Angle=%F Gravity=%F, Temp=%F, Battery=%F, "
-                   "Id=%s." CR),
-                 gmd.type.c_str(), gmd.angle, gmd.gravity, gmd.tempC,
-                 gmd.battery, gmd.id.c_str());
-      push.sendAll(gmd.angle, gmd.gravity, gmd.tempC, gmd.battery, gmd.interval,
-                   gmd.id.c_str(), gmd.token.c_str(), gmd.name.c_str());
-      gmd.setPushed();
-    }
+    if (count < PUSH_QUEUE_SIZE && isPushDue(gmd)) slot[count++] = &gmd;
   }
 
   // Process gravitymon from HTTP
-  for (int i = 0; i < NO_GRAVITYMON; i++) {
+  for (int i = 0; i < myWebServer.getGravitymonCount(); i++) {
     GravitymonData& gmd = myWebServer.getGravitymonData(i);
 
-    if (gmd.updated && (gmd.getPushAge() > myConfig.getPushResendTime())) {
-      addLogEntry(gmd.id.c_str(), gmd.timeinfoUpdated, gmd.gravity, gmd.tempC);
+    if (count < PUSH_QUEUE_SIZE && isPushDue(gmd)) slot[count++] = &gmd;
+  }
 
-      Log.notice(F("Main: Type=%s, Angle=%F Gravity=%F, Temp=%F, Battery=%F, "
-                   "Id=%s." CR),
-                 gmd.type.c_str(), gmd.angle, gmd.gravity, gmd.tempC,
-                 gmd.battery, gmd.id.c_str());
-      push.sendAll(gmd.angle, gmd.gravity, gmd.tempC, gmd.battery, gmd.interval,
-                   gmd.id.c_str(), gmd.token.c_str(), gmd.name.c_str());
-      gmd.setPushed();
-    }
+  for (int i = 0; i < count; i++) {
+    if (queuePush(*slot[i], i == count - 1)) pushSlotPushes++;
   }
+
+  if (!pushSlotPushes) bleScanner.endPushSlot(0);
+  pushDueTime = 0;
+}
+
+bool isPushDue(GravitymonData& gmd) {
+  return gmd.updated && (gmd.getPushAge() > myConfig.getPushResendTime());
+}
+
+// Hand the reading to the push dispatcher, returns false if the queue is full
+bool queuePush(GravitymonData& gmd, bool last) {
+  PushRequest req;
+
+  req.angle = gmd.getAngle();
+  req.gravity = gmd.getGravity();
+  req.tempC = gmd.getTempC();
+  req.battery = gmd.getBattery();
+  req.interval = gmd.interval;
+  req.timestamp = timestampToEpoch(gmd.timeUpdated);
+  req.last = last;
+  req.test = -1;
+  strlcpy(&req.id[0], gmd.getId(), sizeof(req.id));
+  strlcpy(&req.token[0], &gmd.token[0], sizeof(req.token));
+  strlcpy(&req.name[0], &gmd.name[0], sizeof(req.name));
+
+  if (!myPush.queue(req)) return false;
+
+  addLogEntry(gmd.getId(), gmd.timeUpdated, req.gravity, req.tempC);
+
+  Log.notice(F("Main: Type=%s, Angle=%F Gravity=%F, Temp=%F, Battery=%F, "
+               "Id=%s." CR),
+             gmd.getSourceName(), req.angle, req.gravity, req.tempC,
+             req.battery, gmd.getId());
+  gmd.setPushed();
+  return true;
 }
 
 void renderDisplayHeader() {
@@ -0,0 +1,154 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <config.hpp>
+#include <log.hpp>
+#include <mqttsession.hpp>
+
+MqttSession myMqtt;
+
+// FNV-1a
+static uint32_t hashPassword(const char *s) {
+  uint32_t hash = 2166136261u;
+
+  while (*s) {
+    hash ^= static_cast<uint8_t>(*s++);
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+bool MqttSession::connect() {
+  String host = myConfig.getMqttTarget();
+  int port = myConfig.getMqttPort();
+  String user = myConfig.getMqttUser();
+  uint32_t passHash = hashPassword(myConfig.getMqttPass());
+
+  // Settings changed since the session was opened
+  if (_mqtt.connected() && (host != _host || port != _port || user != _user ||
+                            passHash != _passHash))
+    disconnect();
+
+  if (_mqtt.connected()) return true;
+
+  _host = host;
+  _port = port;
+  _user = user;
+  _passHash = passHash;
+
+  // Same rule as BasePush for when to use TLS
+  if (port > 8000) {
+    _wifiSecure.setInsecure();
+    _mqtt.begin(_host.c_str(), _port, _wifiSecure);
+  } else {
+    _mqtt.begin(_host.c_str(), _port, _wifi);
+  }
+
+  _mqtt.setOptions(MQTT_KEEPALIVE, true, _timeout);
+
+  if (!_mqtt.connect(myConfig.getMDNS(), myConfig.getMqttUser(),
+                     myConfig.getMqttPass())) {
+    Log.error(F("MQTT: Failed to connect to %s:%d, error %d." CR),
+              _host.c_str(), _port, _mqtt.lastError());
+    _failures++;
+    _connected.store(false);
+    return false;
+  }
+
+  if (_everConnected) _reconnects++;
+
+  Log.notice(F("MQTT: Connected to %s:%d." CR), _host.c_str(), _port);
+  _everConnected = true;
+  _connected.store(true);
+  return true;
+}
+
+bool MqttSession::publish(const String &payload) {
+  if (!connect()) return false;
+
+  char line[MQTT_LINE_MAX];
+  const char *p = payload.c_str();
+  bool success = true;
+
+  while (*p) {
+    const char *end = strchr(p, '|');
+    size_t length = end ? end - p : strlen(p);
+
+    if (length >= sizeof(line)) {
+      Log.error(F("MQTT: Topic and value too long, skipping." CR));
+    } else if (length) {
+      memcpy(&line[0], p, length);
+      line[length] = 0;
+
+      char *value = strchr(&line[0], ':');
+
+      if (value) {
+        *value++ = 0;
+
+        uint32_t start = micros();
+        bool sent = _mqtt.publish(&line[0], value);
+        _publishTime.fetch_add(micros() - start);
+        _publishes++;
+
+        if (!sent) {
+          Log.error(F("MQTT: Failed to publish %s, error %d." CR), &line[0],
+                    _mqtt.lastError());
+          success = false;
+        }
+      }
+    }
+
+    p += length;
+    if (*p) p++;
+  }
+
+  // Close the session on errors so the next push opens a new one
+  if (!success) {
+    _failures++;
+    disconnect();
+  }
+
+  return success;
+}
+
+void MqttSession::loop() {
+  if (!_connected.load()) return;
+
+  if (!myConfig.hasTargetMqtt()) {
+    disconnect();
+    return;
+  }
+
+  if (!_mqtt.loop() || !_mqtt.connected()) {
+    Log.notice(F("MQTT: Connection to %s lost." CR), _host.c_str());
+    _connected.store(false);
+  }
+}
+
+void MqttSession::disconnect() {
+  if (_mqtt.connected()) _mqtt.disconnect();
+  _connected.store(false);
+}
+
+// EOF
@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_MQTTSESSION_HPP_
+#define SRC_MQTTSESSION_HPP_
+
+#include <MQTT.h>
+#include <WiFiClientSecure.h>
+
+#include <atomic>
+
+constexpr auto MQTT_BUFFER_SIZE = 512;
+constexpr auto MQTT_KEEPALIVE = 60;    // s
+constexpr auto MQTT_TIMEOUT = 1000;    // ms
+constexpr auto MQTT_LINE_MAX = 256;    // Longest topic:value pair
+
+// Broker connection that is kept open between pushes, all topics of all due
+// devices are published on the same socket. Only used from the push task,
+// the counters can be read from other tasks.
+class MqttSession {
+ private:
+  WiFiClient _wifi;
+  WiFiClientSecure _wifiSecure;
+  MQTTClient _mqtt{MQTT_BUFFER_SIZE};
+  String _host;
+  int _port = 0;
+  String _user;
+  uint32_t _passHash = 0;  // Detects a changed password without a copy
+  bool _everConnected = false;
+  int _timeout = MQTT_TIMEOUT;
+
+  std::atomic<bool> _connected{false};
+  std::atomic<uint32_t> _reconnects{0};
+  std::atomic<uint32_t> _failures{0};
+  std::atomic<uint32_t> _publishes{0};
+  std::atomic<uint32_t> _publishTime{0};
+
+  bool connect();
+
+ public:
+  // Payload is topic:value pairs separated by |, returns false if the broker
+  // could not be reached or a publish failed.
+  bool publish(const String &payload);
+
+  // Call regularly to send keepalive pings and handle the socket
+  void loop();
+  void disconnect();
+  void setTimeout(int timeout) { _timeout = timeout; }  // ms
+
+  bool isConnected() { return _connected.load(); }
+  uint32_t getReconnects() { return _reconnects.load(); }
+  uint32_t getFailures() { return _failures.load(); }
+  uint32_t getPublishes() { return _publishes.load(); }
+  uint32_t getPublishTime() {  // Average us per publish
+    uint32_t count = _publishes.load();
+    return count ? _publishTime.load() / count : 0;
+  }
+};
+
+extern MqttSession myMqtt;
+
+#endif  // SRC_MQTTSESSION_HPP_
+
+// EOF
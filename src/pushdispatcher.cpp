@@ -0,0 +1,330 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <config.hpp>
+#include <log.hpp>
+#include <mqttsession.hpp>
+#include <pushdispatcher.hpp>
+#include <tasks.hpp>
+
+#include <new>
+
+PushDispatcher myPush;
+
+bool PushDispatcher::begin() {
+  static const char *const names[PUSH_WORKERS] = {"push1", "push2"};
+  int pending = 0;
+  TaskHandle_t task;
+
+  for (int t = 0; t < GravmonGatewayPush::TEMPLATE_MAX; t++) {
+    PushTargetQueue &target = _targets[t];
+
+    target.target = static_cast<GravmonGatewayPush::Templates>(t);
+    target.queue = xQueueCreate(PUSH_TARGET_LIMITS[t].limit, sizeof(PushJob));
+    pending += PUSH_TARGET_LIMITS[t].limit;
+
+    if (!target.queue) return false;
+  }
+
+  _queue = xQueueCreate(PUSH_QUEUE_SIZE, sizeof(PushRequest));
+  _lock = xSemaphoreCreateMutex();
+  _pending = xSemaphoreCreateCounting(pending, 0);
+
+  if (!_queue || !_lock || !_pending) return false;
+
+  for (int i = 0; i < PUSH_WORKERS; i++) {
+    if (xTaskCreatePinnedToCore(workerTask, names[i], PUSH_WORKER_STACK,
+                                reinterpret_cast<void *>(i), 1, &task,
+                                TASK_CORE_APP) != pdPASS)
+      return false;
+
+    myTasks.add(static_cast<TaskId>(TASK_PUSH_WORKER1 + i), names[i], task,
+                TASK_CORE_APP);
+  }
+
+  if (xTaskCreatePinnedToCore(dispatchTask, "push", PUSH_DISPATCH_STACK,
+                              nullptr, 1, &task, TASK_CORE_APP) != pdPASS)
+    return false;
+
+  myTasks.add(TASK_PUSH, "push", task, TASK_CORE_APP);
+  return true;
+}
+
+bool PushDispatcher::queue(const PushRequest &req) {
+  if (!_queue) return false;
+
+  _queued++;
+
+  if (xQueueSend(_queue, &req, 0) != pdTRUE) {
+    _queued--;
+    return false;
+  }
+
+  return true;
+}
+
+bool PushDispatcher::queueTest(GravmonGatewayPush::Templates t) {
+  PushRequest req;
+
+  req.angle = 45;
+  req.gravity = 1.030;
+  req.tempC = 22.1;
+  req.battery = 4.12;
+  req.interval = 900;
+  req.timestamp = 0;
+  req.last = true;
+  req.test = t;
+  strlcpy(&req.id[0], myConfig.getID(), sizeof(req.id));
+  strlcpy(&req.token[0], myConfig.getToken(), sizeof(req.token));
+  strlcpy(&req.name[0], myConfig.getMDNS(), sizeof(req.name));
+
+  _testDone = false;
+  return queue(req);
+}
+
+void PushDispatcher::completeTest(bool success, int code) {
+  _testSuccess = success;
+  _testCode = code;
+  _testDone = true;
+}
+
+void PushDispatcher::dispatchTask(void *param) {
+  PushRequest req;
+
+  while (true) {
+    bool received = xQueueReceive(myPush._queue, &req, pdMS_TO_TICKS(1000));
+
+    myTasks.begin(TASK_PUSH);
+
+    if (received)
+      myPush.dispatch(req);
+    else
+      myPush.flushInfluxDb2(-1);  // In case the last push of the slot failed
+
+    myTasks.end(TASK_PUSH);
+  }
+}
+
+// Render the reading once for each distinct template and hand the documents
+// to the enabled targets. A target that still has its queue full from earlier
+// pushes skips this one instead of holding up the others.
+void PushDispatcher::dispatch(const PushRequest &req) {
+  TemplateValues values(req.angle, req.gravity, req.tempC, req.battery,
+                        req.interval, &req.id[0], &req.token[0], &req.name[0]);
+  PushDocument *docs[GravmonGatewayPush::TEMPLATE_MAX];
+  uint64_t hashes[GravmonGatewayPush::TEMPLATE_MAX];
+  int rendered = 0;
+
+  for (int t = 0; t < GravmonGatewayPush::TEMPLATE_MAX; t++) {
+    auto target = static_cast<GravmonGatewayPush::Templates>(t);
+
+    if (req.test >= 0 ? req.test != t
+                      : !GravmonGatewayPush::isTargetEnabled(target))
+      continue;
+
+    if (target == GravmonGatewayPush::TEMPLATE_INFLUX) {
+      addInfluxDb2(values, req);
+      continue;
+    }
+
+    uint64_t hash = GravmonGatewayPush::getTemplateHash(target);
+    PushDocument *doc = nullptr;
+
+    for (int i = 0; i < rendered && !doc; i++) {
+      if (hashes[i] == hash) doc = docs[i];
+    }
+
+    if (!doc) {
+      doc = new (std::nothrow) PushDocument();
+      if (!doc) continue;
+
+      hashes[rendered] =
+          GravmonGatewayPush::renderTemplate(target, values, doc->text);
+      docs[rendered++] = doc;
+    }
+
+    queueJob(t, doc, req.test);
+  }
+
+  for (int i = 0; i < rendered; i++) docs[i]->release();
+
+  _queued--;
+}
+
+bool PushDispatcher::queueJob(int t, PushDocument *doc, int8_t test) {
+  PushJob job = {doc, test};
+
+  doc->refs++;
+
+  if (xQueueSend(_targets[t].queue, &job, 0) == pdTRUE) {
+    xSemaphoreGive(_pending);
+    return true;
+  }
+
+  doc->refs--;  // The dispatcher still holds a reference
+  _targets[t].dropped++;
+  Log.warning(F("PUSH: Target %s is busy, skipping push." CR),
+              PUSH_TARGET_LIMITS[t].name);
+  if (test >= 0) completeTest(false, 0);
+  return false;
+}
+
+// Influx lines are collected until the last push of the slot and written in
+// one request
+void PushDispatcher::addInfluxDb2(TemplateValues &values,
+                                  const PushRequest &req) {
+  String doc;
+
+  GravmonGatewayPush::renderTemplate(GravmonGatewayPush::TEMPLATE_INFLUX,
+                                     values, doc);
+
+  if (!_influxBatch) _influxBatch = new (std::nothrow) PushDocument();
+
+  if (_influxBatch)
+    _influxLines += GravmonGatewayPush::addInfluxDb2Lines(
+        _influxBatch->text, doc, req.timestamp);
+
+  if (req.last || req.test >= 0) flushInfluxDb2(req.test);
+}
+
+void PushDispatcher::flushInfluxDb2(int8_t test) {
+  if (!_influxBatch) return;
+
+  Log.notice(F("PUSH: Sending %d lines to influxdb." CR), _influxLines);
+  queueJob(GravmonGatewayPush::TEMPLATE_INFLUX, _influxBatch, test);
+  _influxBatch->release();
+  _influxBatch = nullptr;
+  _influxLines = 0;
+}
+
+bool PushDispatcher::isHandshaking() {
+  uint32_t now = millis();
+
+  for (int i = 0; i < PUSH_WORKERS; i++) {
+    uint32_t start = _handshakes[i].load();
+
+    if (start && now - start < PUSH_HANDSHAKE_TIME) return true;
+  }
+
+  return false;
+}
+
+void PushDispatcher::workerTask(void *param) {
+  myPush.work(static_cast<int>(reinterpret_cast<intptr_t>(param)));
+}
+
+// Take a job from the next target that is below its concurrency limit, round
+// robin so a target with a long queue does not starve the others
+bool PushDispatcher::takeJob(int &t, PushJob &job) {
+  bool found = false;
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+
+  for (int i = 0; i < GravmonGatewayPush::TEMPLATE_MAX && !found; i++) {
+    int n = (_next + i) % GravmonGatewayPush::TEMPLATE_MAX;
+    PushTargetQueue &target = _targets[n];
+
+    if (target.running < PUSH_TARGET_LIMITS[n].concurrency &&
+        xQueueReceive(target.queue, &job, 0) == pdTRUE) {
+      target.running++;
+      _next = (n + 1) % GravmonGatewayPush::TEMPLATE_MAX;
+      t = n;
+      found = true;
+    }
+  }
+
+  xSemaphoreGive(_lock);
+  return found;
+}
+
+// Reserve a target without a job, used to run the MQTT session loop
+bool PushDispatcher::claim(int t) {
+  bool claimed = false;
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+
+  if (!_targets[t].running) {
+    _targets[t].running++;
+    claimed = true;
+  }
+
+  xSemaphoreGive(_lock);
+  return claimed;
+}
+
+void PushDispatcher::finish(int t) {
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  _targets[t].running--;
+  xSemaphoreGive(_lock);
+}
+
+// A job that was held back by the concurrency limit is picked up by the
+// worker that finishes the running job of that target
+void PushDispatcher::work(int worker) {
+  TaskId id = static_cast<TaskId>(TASK_PUSH_WORKER1 + worker);
+  GravmonGatewayPush push(&myConfig);
+  PushJob job;
+  int t;
+
+  push.setMqttSession(&myMqtt);
+
+  while (true) {
+    xSemaphoreTake(_pending, pdMS_TO_TICKS(1000));
+
+    myTasks.begin(id);
+
+    while (takeJob(t, job)) {
+      PushTargetQueue &target = _targets[t];
+      uint32_t start = millis();
+
+      // The handshake can't be told apart from the rest of the send, so the
+      // whole send counts until the max time
+      if (push.isTlsConnect(target.target)) _handshakes[worker] = start | 1;
+
+      push.setTimeout(PUSH_TARGET_LIMITS[t].timeout);
+      push.sendDocument(target.target, job.doc->text);
+      _handshakes[worker] = 0;
+      job.doc->release();
+      finish(t);
+
+      target.time += millis() - start;
+      target.lastCode = push.getLastCode();
+      if (push.getLastSuccess())
+        target.sent++;
+      else
+        target.failed++;
+
+      if (job.test >= 0)
+        completeTest(push.getLastSuccess(), push.getLastCode());
+    }
+
+    if (claim(GravmonGatewayPush::TEMPLATE_MQTT)) {
+      myMqtt.loop();
+      finish(GravmonGatewayPush::TEMPLATE_MQTT);
+    }
+
+    myTasks.end(id);
+  }
+}
+
+// EOF
@@ -0,0 +1,160 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_PUSHDISPATCHER_HPP_
+#define SRC_PUSHDISPATCHER_HPP_
+
+#include <Arduino.h>
+
+#include <atomic>
+#include <pushtarget.hpp>
+#include <reading.hpp>
+
+constexpr auto PUSH_QUEUE_SIZE = 8;
+constexpr auto PUSH_DISPATCH_STACK = 4096;
+constexpr auto PUSH_WORKER_STACK = 8192;    // TLS needs a large stack
+constexpr auto PUSH_WORKERS = 2;            // Shared by all targets
+constexpr auto PUSH_HANDSHAKE_TIME = 2000;  // ms, max scan pause for TLS
+
+// Copy of a reading so the push tasks do not touch the device tables
+struct PushRequest {
+  float angle;
+  float gravity;
+  float tempC;
+  float battery;
+  int interval;
+  time_t timestamp;  // Capture time, 0 if the clock is not synced
+  bool last;         // Last push of the slot, batched data is sent
+  int8_t test;       // Target to test, -1 for a normal push
+  char id[GRAVITYMON_ID_SIZE];
+  char token[65];
+  char name[33];
+};
+
+// Rendered document, shared by the targets that have templates with the same
+// hash. The dispatcher and each job hold a reference, the last one frees it.
+struct PushDocument {
+  std::atomic<int> refs{1};
+  String text;
+
+  void release() {
+    if (--refs == 0) delete this;
+  }
+};
+
+// Document queued for one target
+struct PushJob {
+  PushDocument *doc;
+  int8_t test;  // Target to test, -1 for a normal push
+};
+
+// Limits for each target, same order as GravmonGatewayPush::Templates
+struct PushTargetLimits {
+  const char *name;
+  uint16_t timeout;     // ms, for connecting and for the response
+  uint8_t limit;        // Jobs queued, more are dropped
+  uint8_t concurrency;  // Jobs sent at the same time
+};
+
+// Influx batches must stay in order and MQTT has a single session
+constexpr PushTargetLimits
+    PUSH_TARGET_LIMITS[GravmonGatewayPush::TEMPLATE_MAX] = {
+        {"http1", 5000, 4, 2},  {"http2", 5000, 4, 2}, {"http3", 5000, 4, 2},
+        {"influx", 5000, 8, 1}, {"mqtt", 2000, 8, 1},
+};
+
+struct PushTargetQueue {
+  GravmonGatewayPush::Templates target;
+  QueueHandle_t queue = nullptr;
+  uint8_t running = 0;  // Guarded by the dispatcher lock
+  std::atomic<uint32_t> sent{0};
+  std::atomic<uint32_t> failed{0};
+  std::atomic<uint32_t> dropped{0};
+  std::atomic<uint32_t> time{0};  // ms in total
+  std::atomic<int> lastCode{0};
+
+  uint32_t getTime() {  // Average ms per push
+    uint32_t count = sent.load() + failed.load();
+    return count ? time.load() / count : 0;
+  }
+};
+
+// Pushes are queued by the controller. A dispatcher task renders each reading
+// once per distinct template and queues the documents for the enabled
+// targets. A small pool of workers takes the jobs round robin from the targets
+// that are below their concurrency limit, so a target that is slow or
+// unreachable only uses its own share of the workers. Each worker owns its push
+// client.
+class PushDispatcher {
+ private:
+  QueueHandle_t _queue = nullptr;
+  SemaphoreHandle_t _lock = nullptr;
+  SemaphoreHandle_t _pending = nullptr;  // Given for each queued job
+  PushTargetQueue _targets[GravmonGatewayPush::TEMPLATE_MAX];
+  int _next = 0;  // Target to look at first, guarded by _lock
+  std::atomic<int> _queued{0};
+  std::atomic<uint32_t> _handshakes[PUSH_WORKERS];  // Start, 0 if none
+  PushDocument *_influxBatch = nullptr;  // Lines of the current push slot
+  int _influxLines = 0;
+
+  std::atomic<bool> _testDone{false};
+  std::atomic<bool> _testSuccess{false};
+  std::atomic<int> _testCode{0};
+
+  static void dispatchTask(void *param);
+  static void workerTask(void *param);
+  void dispatch(const PushRequest &req);
+  bool queueJob(int t, PushDocument *doc, int8_t test);
+  void addInfluxDb2(TemplateValues &values, const PushRequest &req);
+  void flushInfluxDb2(int8_t test);
+  bool takeJob(int &t, PushJob &job);
+  bool claim(int t);
+  void finish(int t);
+  void work(int worker);
+  void completeTest(bool success, int code);
+
+ public:
+  bool begin();
+
+  // Returns false if the queue is full, never blocks
+  bool queue(const PushRequest &req);
+  bool queueTest(GravmonGatewayPush::Templates t);
+
+  // Requests not yet handed to the workers
+  int getQueued() { return _queued.load(); }
+
+  // A worker is doing a TLS handshake, the heavy part of a push on the radio
+  bool isHandshaking();
+
+  bool isTestDone() { return _testDone.load(); }
+  bool getTestSuccess() { return _testSuccess.load(); }
+  int getTestCode() { return _testCode.load(); }
+
+  PushTargetQueue &getTarget(int idx) { return _targets[idx]; }
+};
+
+extern PushDispatcher myPush;
+
+#endif  // SRC_PUSHDISPATCHER_HPP_
+
+// EOF
@@ -27,7 +27,8 @@ SOFTWARE.
 #include <helper.hpp>
 #include <main.hpp>
 #include <pushtarget.hpp>
-#include <templating.hpp>
+
+#include <atomic>
 
 // Use iSpindle format for compatibility, HTTP POST
 const char iSpindleFormat[] PROGMEM =
@@ -82,181 +83,247 @@ GravmonGatewayPush::GravmonGatewayPush(
   _gravmonGatewayConfig = gravmonGatewayConfig;
 }
 
-void GravmonGatewayPush::sendAll(float angle, float gravitySG, float tempC,
-                                 float battery, int interval, const char* id,
-                                 const char* token, const char* mdns) {
-  printHeap("PUSH");
-  _http.setReuse(true);
-  _httpSecure.setReuse(true);
+// Templates are read from LittleFS once and kept compiled in RAM, shared by
+// all push instances. The generation is bumped when a template is saved or
+// removed and the cache is reloaded before the next render.
+struct TemplateCacheEntry {
+  CompiledTemplate compiled;
+  uint64_t hash = 0;  // FNV-1a of the template text
+};
+
+static TemplateCacheEntry templateCache[GravmonGatewayPush::TEMPLATE_MAX];
+static uint32_t templateCacheGeneration = 0;
+static std::atomic<uint32_t> templateGeneration{1};
+
+static SemaphoreHandle_t getTemplateLock() {
+  static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+  return lock;
+}
 
-  TemplatingEngine engine;
-  setupTemplateEngine(engine, angle, gravitySG, tempC, battery, interval, id,
-                      token, mdns);
+static uint64_t hashTemplate(const char* s) {
+  uint64_t hash = 14695981039346656037ull;
 
-  if (myConfig.hasTargetHttpPost()) {
-    String tpl = getTemplate(GravmonGatewayPush::TEMPLATE_HTTP1);
-    String doc = engine.create(tpl.c_str());
-    sendHttpPost(doc);
+  while (*s) {
+    hash ^= static_cast<uint8_t>(*s++);
+    hash *= 1099511628211ull;
   }
 
-  if (myConfig.hasTargetHttpPost2()) {
-    String tpl = getTemplate(GravmonGatewayPush::TEMPLATE_HTTP2);
-    String doc = engine.create(tpl.c_str());
-    sendHttpPost2(doc);
-  }
+  return hash;
+}
+
+static void loadTemplate(GravmonGatewayPush::Templates t) {
+  const char* fname = "";
+  const char* tpl = "";
 
-  if (myConfig.hasTargetHttpGet()) {
-    String tpl = getTemplate(GravmonGatewayPush::TEMPLATE_HTTP3);
-    String doc = engine.create(tpl.c_str());
-    sendHttpGet(doc);
+  switch (t) {
+    case GravmonGatewayPush::TEMPLATE_HTTP1:
+      tpl = iSpindleFormat;
+      fname = TPL_FNAME_POST;
+      break;
+    case GravmonGatewayPush::TEMPLATE_HTTP2:
+      tpl = iSpindleFormat;
+      fname = TPL_FNAME_POST2;
+      break;
+    case GravmonGatewayPush::TEMPLATE_HTTP3:
+      tpl = iHttpGetFormat;
+      fname = TPL_FNAME_GET;
+      break;
+    case GravmonGatewayPush::TEMPLATE_INFLUX:
+      tpl = influxDbFormat;
+      fname = TPL_FNAME_INFLUXDB;
+      break;
+    case GravmonGatewayPush::TEMPLATE_MQTT:
+      tpl = mqttFormat;
+      fname = TPL_FNAME_MQTT;
+      break;
+    default:
+      break;
   }
 
-  if (myConfig.hasTargetInfluxDb2()) {
-    String tpl = getTemplate(GravmonGatewayPush::TEMPLATE_INFLUX);
-    String doc = engine.create(tpl.c_str());
-    sendInfluxDb2(doc);
+  char* text = nullptr;
+  File file = LittleFS.open(fname, "r");
+
+  if (file) {
+    size_t size = file.size();
+    text = static_cast<char*>(malloc(size + 1));
+
+    if (text) {
+      text[file.readBytes(text, size)] = 0;
+      tpl = text;
+      Log.notice(F("PUSH: Template loaded from disk %s." CR), fname);
+    }
+
+    file.close();
   }
 
-  if (myConfig.hasTargetMqtt()) {
-    String tpl = getTemplate(GravmonGatewayPush::TEMPLATE_MQTT);
-    String doc = engine.create(tpl.c_str());
-    sendMqtt(doc);
+  templateCache[t].compiled.compile(tpl);
+  templateCache[t].hash = hashTemplate(tpl);
+  free(text);
+}
+
+static void loadTemplateCache() {
+  uint32_t generation = templateGeneration.load();
+
+  for (int t = 0; t < GravmonGatewayPush::TEMPLATE_MAX; t++)
+    loadTemplate(static_cast<GravmonGatewayPush::Templates>(t));
+
+  templateCacheGeneration = generation;
+}
+
+void GravmonGatewayPush::loadTemplates() {
+  xSemaphoreTake(getTemplateLock(), portMAX_DELAY);
+  loadTemplateCache();
+  xSemaphoreGive(getTemplateLock());
+}
+
+void GravmonGatewayPush::invalidateTemplates() { templateGeneration++; }
+
+uint64_t GravmonGatewayPush::renderTemplate(Templates t,
+                                            TemplateValues& values,
+                                            String& doc) {
+  xSemaphoreTake(getTemplateLock(), portMAX_DELAY);
+
+  if (templateCacheGeneration != templateGeneration.load())
+    loadTemplateCache();
+
+  templateCache[t].compiled.render(values, doc);
+  uint64_t hash = templateCache[t].hash;
+
+  xSemaphoreGive(getTemplateLock());
+  return hash;
+}
+
+uint64_t GravmonGatewayPush::getTemplateHash(Templates t) {
+  xSemaphoreTake(getTemplateLock(), portMAX_DELAY);
+
+  if (templateCacheGeneration != templateGeneration.load())
+    loadTemplateCache();
+
+  uint64_t hash = templateCache[t].hash;
+
+  xSemaphoreGive(getTemplateLock());
+  return hash;
+}
+
+bool GravmonGatewayPush::isTargetEnabled(Templates t) {
+  switch (t) {
+    case TEMPLATE_HTTP1:
+      return myConfig.hasTargetHttpPost();
+    case TEMPLATE_HTTP2:
+      return myConfig.hasTargetHttpPost2();
+    case TEMPLATE_HTTP3:
+      return myConfig.hasTargetHttpGet();
+    case TEMPLATE_INFLUX:
+      return myConfig.hasTargetInfluxDb2();
+    case TEMPLATE_MQTT:
+      return myConfig.hasTargetMqtt();
+    default:
+      return false;
   }
+}
 
-  engine.freeMemory();
+static bool isHttpsUrl(const char* url) {
+  return strncasecmp(url, "https:", 6) == 0;
+}
+
+bool GravmonGatewayPush::isTlsConnect(Templates t) {
+  switch (t) {
+    case TEMPLATE_HTTP1:
+      return isHttpsUrl(myConfig.getTargetHttpPost());
+    case TEMPLATE_HTTP2:
+      return isHttpsUrl(myConfig.getTargetHttpPost2());
+    case TEMPLATE_HTTP3:
+      return isHttpsUrl(myConfig.getTargetHttpGet());
+    case TEMPLATE_INFLUX:
+      return isHttpsUrl(myConfig.getTargetInfluxDB2());
+    case TEMPLATE_MQTT:
+      return myConfig.getMqttPort() > 8000 &&
+             !(_mqttSession && _mqttSession->isConnected());
+    default:
+      return false;
+  }
 }
 
-const char* GravmonGatewayPush::getTemplate(Templates t,
-                                            bool useDefaultTemplate) {
-  String fname;
-  _baseTemplate.reserve(600);
+void GravmonGatewayPush::sendDocument(Templates t, String& doc) {
+  _http.setReuse(true);
+  _httpSecure.setReuse(true);
 
-  // Load templates from memory
   switch (t) {
     case TEMPLATE_HTTP1:
-      _baseTemplate = String(iSpindleFormat);
-      fname = TPL_FNAME_POST;
+      sendHttpPost(doc);
       break;
     case TEMPLATE_HTTP2:
-      _baseTemplate = String(iSpindleFormat);
-      fname = TPL_FNAME_POST2;
+      sendHttpPost2(doc);
       break;
     case TEMPLATE_HTTP3:
-      _baseTemplate = String(iHttpGetFormat);
-      fname = TPL_FNAME_GET;
+      sendHttpGet(doc);
       break;
     case TEMPLATE_INFLUX:
-      _baseTemplate = String(influxDbFormat);
-      fname = TPL_FNAME_INFLUXDB;
+      sendInfluxDb2Lines(doc);
       break;
     case TEMPLATE_MQTT:
-      _baseTemplate = String(mqttFormat);
-      fname = TPL_FNAME_MQTT;
+      if (_mqttSession)
+        _lastSuccess = _mqttSession->publish(doc);
+      else
+        sendMqtt(doc);
+      break;
+    default:
       break;
   }
+}
 
-  if (!useDefaultTemplate) {
-    File file = LittleFS.open(fname, "r");
-    if (file) {
-      char buf[file.size() + 1];
-      memset(&buf[0], 0, file.size() + 1);
-      file.readBytes(&buf[0], file.size());
-      _baseTemplate = String(&buf[0]);
-      file.close();
-      Log.notice(F("PUSH: Template loaded from disk %s." CR), fname.c_str());
-    }
-  }
-
-  return _baseTemplate.c_str();
+void GravmonGatewayPush::setTimeout(uint16_t timeout) {
+  _http.setTimeout(timeout);
+  _http.setConnectTimeout(timeout);
+  _httpSecure.setTimeout(timeout);
+  _httpSecure.setConnectTimeout(timeout);
+  if (_mqttSession) _mqttSession->setTimeout(timeout);
 }
 
-void GravmonGatewayPush::setupTemplateEngine(TemplatingEngine& engine,
-                                             float angle, float gravitySG,
-                                             float tempC, float voltage,
-                                             int interval, const char* id,
-                                             const char* token,
-                                             const char* name) {
-  float runTime = 0, corrGravitySG = gravitySG;
-
-  //  Names
-  engine.setVal(TPL_MDNS, strlen(name) ? name : myConfig.getMDNS());
-  engine.setVal(TPL_ID, id);
-  engine.setVal(TPL_TOKEN, strlen(token) ? token : myConfig.getToken());
-  engine.setVal(TPL_TOKEN2, strlen(token) ? token : myConfig.getToken());
-
-  // Temperature
-  if (myConfig.isTempFormatC()) {
-    engine.setVal(TPL_TEMP, tempC, DECIMALS_TEMP);
-  } else {
-    engine.setVal(TPL_TEMP, convertCtoF(tempC), DECIMALS_TEMP);
+// The lines are timestamped so that the readings of a push slot can be
+// written in one request, see sendInfluxDb2Lines()
+int GravmonGatewayPush::addInfluxDb2Lines(String& body, const String& doc,
+                                          time_t timestamp) {
+  char ts[24] = "";
+  int length = 0, lines = 0;
+
+  if (timestamp)
+    snprintf(&ts[0], sizeof(ts), " %lu", static_cast<unsigned long>(timestamp));
+
+  body.reserve(body.length() + doc.length() + sizeof(ts));
+
+  for (const char* p = doc.c_str(); *p; p++) {
+    if (*p == '\n') {
+      if (length) {
+        body += &ts[0];
+        lines++;
+      }
+      body += '\n';
+      length = 0;
+    } else {
+      body += *p;
+      length++;
+    }
   }
 
-  engine.setVal(TPL_TEMP_C, tempC, DECIMALS_TEMP);
-  engine.setVal(TPL_TEMP_F, convertCtoF(tempC), DECIMALS_TEMP);
-  engine.setVal(TPL_TEMP_UNITS, myConfig.getTempFormat());
-
-  // Battery & Timer
-  engine.setVal(TPL_BATTERY, voltage, DECIMALS_BATTERY);
-  engine.setVal(TPL_SLEEP_INTERVAL, interval);
-
-  int charge = 0;
-
-  if (voltage > 4.15)
-    charge = 100;
-  else if (voltage > 4.05)
-    charge = 90;
-  else if (voltage > 3.97)
-    charge = 80;
-  else if (voltage > 3.91)
-    charge = 70;
-  else if (voltage > 3.86)
-    charge = 60;
-  else if (voltage > 3.81)
-    charge = 50;
-  else if (voltage > 3.78)
-    charge = 40;
-  else if (voltage > 3.76)
-    charge = 30;
-  else if (voltage > 3.73)
-    charge = 20;
-  else if (voltage > 3.67)
-    charge = 10;
-  else if (voltage > 3.44)
-    charge = 5;
-
-  engine.setVal(TPL_BATTERY_PERCENT, charge);
-
-  // Performance metrics
-  engine.setVal(TPL_RUN_TIME, runTime, DECIMALS_RUNTIME);
-  engine.setVal(TPL_RSSI, WiFi.RSSI());
-
-  // Angle/Tilt
-  engine.setVal(TPL_TILT, angle, DECIMALS_TILT);
-  engine.setVal(TPL_ANGLE, angle, DECIMALS_TILT);
-
-  // Gravity options
-  if (myConfig.isGravitySG()) {
-    engine.setVal(TPL_GRAVITY, gravitySG, DECIMALS_SG);
-    engine.setVal(TPL_GRAVITY_CORR, corrGravitySG, DECIMALS_SG);
-  } else {
-    engine.setVal(TPL_GRAVITY, convertToPlato(gravitySG), DECIMALS_PLATO);
-    engine.setVal(TPL_GRAVITY_CORR, convertToPlato(corrGravitySG),
-                  DECIMALS_PLATO);
+  if (length) {
+    body += &ts[0];
+    body += '\n';
+    lines++;
   }
 
-  engine.setVal(TPL_GRAVITY_G, gravitySG, DECIMALS_SG);
-  engine.setVal(TPL_GRAVITY_P, convertToPlato(gravitySG), DECIMALS_PLATO);
-  engine.setVal(TPL_GRAVITY_CORR_G, corrGravitySG, DECIMALS_SG);
-  engine.setVal(TPL_GRAVITY_CORR_P, convertToPlato(corrGravitySG),
-                DECIMALS_PLATO);
-  engine.setVal(TPL_GRAVITY_UNIT, myConfig.getGravityFormat());
+  return lines;
+}
 
-  engine.setVal(TPL_APP_VER, CFG_APPVER);
-  engine.setVal(TPL_APP_BUILD, CFG_GITREV);
+// BasePush writes without a precision so InfluxDB expects nanoseconds. The
+// batched lines are timestamped in seconds, the bucket is the last parameter
+// of the write url so the precision is added after it.
+void GravmonGatewayPush::sendInfluxDb2Lines(String& payload) {
+  String bucket = String(myConfig.getBucketInfluxDB2()) + "&precision=s";
 
-#if LOG_LEVEL == 6
-  dumpAll();
-#endif
+  sendInfluxDb2(payload, myConfig.getTargetInfluxDB2(),
+                myConfig.getOrgInfluxDB2(), bucket.c_str(),
+                myConfig.getTokenInfluxDB2());
 }
 
 // EOF
@@ -25,32 +25,8 @@ SOFTWARE.
 #define SRC_PUSHTARGET_HPP_
 
 #include <basepush.hpp>
-#include <templating.hpp>
-
-constexpr auto TPL_MDNS = "${mdns}";
-constexpr auto TPL_ID = "${id}";
-constexpr auto TPL_TOKEN = "${token}";
-constexpr auto TPL_TOKEN2 = "${token2}";
-constexpr auto TPL_SLEEP_INTERVAL = "${sleep-interval}";
-constexpr auto TPL_TEMP = "${temp}";
-constexpr auto TPL_TEMP_C = "${temp-c}";
-constexpr auto TPL_TEMP_F = "${temp-f}";
-constexpr auto TPL_TEMP_UNITS = "${temp-unit}";  // C or F
-constexpr auto TPL_BATTERY = "${battery}";
-constexpr auto TPL_BATTERY_PERCENT = "${battery-percent}";
-constexpr auto TPL_RSSI = "${rssi}";
-constexpr auto TPL_RUN_TIME = "${run-time}";
-constexpr auto TPL_ANGLE = "${angle}";
-constexpr auto TPL_TILT = "${tilt}";  // same as angle
-constexpr auto TPL_GRAVITY = "${gravity}";
-constexpr auto TPL_GRAVITY_G = "${gravity-sg}";
-constexpr auto TPL_GRAVITY_P = "${gravity-plato}";
-constexpr auto TPL_GRAVITY_CORR = "${corr-gravity}";
-constexpr auto TPL_GRAVITY_CORR_G = "${corr-gravity-sg}";
-constexpr auto TPL_GRAVITY_CORR_P = "${corr-gravity-plato}";
-constexpr auto TPL_GRAVITY_UNIT = "${gravity-unit}";  // G or P
-constexpr auto TPL_APP_VER = "${app-ver}";
-constexpr auto TPL_APP_BUILD = "${app-build}";
+#include <mqttsession.hpp>
+#include <pushtemplate.hpp>
 
 constexpr auto TPL_FNAME_POST = "/http-1.tpl";
 constexpr auto TPL_FNAME_POST2 = "/http-2.tpl";
@@ -66,7 +42,9 @@ extern const char mqttFormat[] PROGMEM;
 class GravmonGatewayPush : public BasePush {
  private:
   GravmonGatewayConfig* _gravmonGatewayConfig;
-  String _baseTemplate;
+  MqttSession* _mqttSession = nullptr;
+
+  void sendInfluxDb2Lines(String& payload);
 
  public:
   explicit GravmonGatewayPush(GravmonGatewayConfig* gravmonGatewayConfig);
@@ -76,19 +54,38 @@ class GravmonGatewayPush : public BasePush {
     TEMPLATE_HTTP2 = 1,
     TEMPLATE_HTTP3 = 2,
     TEMPLATE_INFLUX = 3,
-    TEMPLATE_MQTT = 4
+    TEMPLATE_MQTT = 4,
+    TEMPLATE_MAX = 5
   };
 
-  void sendAll(float angle, float gravitySG, float tempC, float voltage,
-               int interval, const char* id, const char* token,
-               const char* name);
+  // Send a rendered document to one target, Influx documents are lines from
+  // addInfluxDb2Lines()
+  void sendDocument(Templates t, String& doc);
+  static bool isTargetEnabled(Templates t);
+
+  // True if sending to the target starts with a TLS handshake, the MQTT
+  // session only has one when it connects
+  bool isTlsConnect(Templates t);
+
+  // Timeout for connecting and waiting on the server
+  void setTimeout(uint16_t timeout);
+
+  // Append the rendered lines to the body with the capture time in seconds
+  // since epoch, 0 if unknown. Returns the number of lines added.
+  static int addInfluxDb2Lines(String& body, const String& doc,
+                               time_t timestamp);
+
+  // Publish on a session that is kept open instead of connecting every push
+  void setMqttSession(MqttSession* session) { _mqttSession = session; }
 
-  const char* getTemplate(Templates t, bool useDefaultTemplate = false);
-  void clearTemplate() { _baseTemplate.clear(); }
-  void setupTemplateEngine(TemplatingEngine& engine, float angle,
-                           float gravitySG, float tempC, float voltage,
-                           int interval, const char* id, const char* token,
-                           const char* name);
+  // Templates are loaded at boot and reloaded on the first render after they
+  // have been invalidated. Targets with the same template hash render the
+  // same document, the hash of the template used is returned.
+  static uint64_t renderTemplate(Templates t, TemplateValues& values,
+                                 String& doc);
+  static uint64_t getTemplateHash(Templates t);
+  static void loadTemplates();
+  static void invalidateTemplates();
   int getLastCode() { return _lastResponseCode; }
   bool getLastSuccess() { return _lastSuccess; }
 };
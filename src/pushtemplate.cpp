@@ -0,0 +1,247 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <WiFi.h>
+
+#include <config.hpp>
+#include <helper.hpp>
+#include <main.hpp>
+#include <pushtemplate.hpp>
+
+static const char *const TPL_VAR_KEYS[TPL_VAR_MAX] = {
+    TPL_MDNS,
+    TPL_ID,
+    TPL_TOKEN,
+    TPL_TOKEN2,
+    TPL_SLEEP_INTERVAL,
+    TPL_TEMP,
+    TPL_TEMP_C,
+    TPL_TEMP_F,
+    TPL_TEMP_UNITS,
+    TPL_BATTERY,
+    TPL_BATTERY_PERCENT,
+    TPL_RSSI,
+    TPL_RUN_TIME,
+    TPL_ANGLE,
+    TPL_TILT,
+    TPL_GRAVITY,
+    TPL_GRAVITY_G,
+    TPL_GRAVITY_P,
+    TPL_GRAVITY_CORR,
+    TPL_GRAVITY_CORR_G,
+    TPL_GRAVITY_CORR_P,
+    TPL_GRAVITY_UNIT,
+    TPL_APP_VER,
+    TPL_APP_BUILD,
+};
+
+static_assert(TPL_VAR_MAX <= 32, "Formatted flags only hold 32 variables");
+
+// Approximate charge of a lipo battery
+static int getBatteryCharge(float voltage) {
+  if (voltage > 4.15) return 100;
+  if (voltage > 4.05) return 90;
+  if (voltage > 3.97) return 80;
+  if (voltage > 3.91) return 70;
+  if (voltage > 3.86) return 60;
+  if (voltage > 3.81) return 50;
+  if (voltage > 3.78) return 40;
+  if (voltage > 3.76) return 30;
+  if (voltage > 3.73) return 20;
+  if (voltage > 3.67) return 10;
+  if (voltage > 3.44) return 5;
+  return 0;
+}
+
+TemplateValues::TemplateValues(float angle, float gravitySG, float tempC,
+                               float battery, int interval, const char *id,
+                               const char *token, const char *name) {
+  _angle = angle;
+  _gravitySG = gravitySG;
+  _tempC = tempC;
+  _battery = battery;
+  _interval = interval;
+  _id = id;
+  _token = token;
+  _name = name;
+}
+
+// Numbers are formatted like String(value, decimals) in TemplatingEngine
+const char *TemplateValues::format(TemplateVar var) {
+  char *buf = &_buffer[var][0];
+  const char *value = buf;
+  float runTime = 0, corrGravitySG = _gravitySG;
+
+  switch (var) {
+    case TPL_VAR_MDNS:
+      value = strlen(_name) ? _name : myConfig.getMDNS();
+      break;
+    case TPL_VAR_ID:
+      value = _id;
+      break;
+    case TPL_VAR_TOKEN:
+    case TPL_VAR_TOKEN2:
+      value = strlen(_token) ? _token : myConfig.getToken();
+      break;
+    case TPL_VAR_SLEEP_INTERVAL:
+      snprintf(buf, TPL_VALUE_SIZE, "%d", _interval);
+      break;
+    case TPL_VAR_TEMP:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_TEMP,
+               myConfig.isTempFormatC() ? _tempC : convertCtoF(_tempC));
+      break;
+    case TPL_VAR_TEMP_C:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_TEMP, _tempC);
+      break;
+    case TPL_VAR_TEMP_F:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_TEMP,
+               convertCtoF(_tempC));
+      break;
+    case TPL_VAR_TEMP_UNITS:
+      buf[0] = myConfig.getTempFormat();
+      buf[1] = 0;
+      break;
+    case TPL_VAR_BATTERY:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_BATTERY, _battery);
+      break;
+    case TPL_VAR_BATTERY_PERCENT:
+      snprintf(buf, TPL_VALUE_SIZE, "%d", getBatteryCharge(_battery));
+      break;
+    case TPL_VAR_RSSI:
+      snprintf(buf, TPL_VALUE_SIZE, "%d", WiFi.RSSI());
+      break;
+    case TPL_VAR_RUN_TIME:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_RUNTIME, runTime);
+      break;
+    case TPL_VAR_ANGLE:
+    case TPL_VAR_TILT:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_TILT, _angle);
+      break;
+    case TPL_VAR_GRAVITY:
+      if (myConfig.isGravitySG())
+        snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_SG, _gravitySG);
+      else
+        snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_PLATO,
+                 convertToPlato(_gravitySG));
+      break;
+    case TPL_VAR_GRAVITY_CORR:
+      if (myConfig.isGravitySG())
+        snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_SG, corrGravitySG);
+      else
+        snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_PLATO,
+                 convertToPlato(corrGravitySG));
+      break;
+    case TPL_VAR_GRAVITY_G:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_SG, _gravitySG);
+      break;
+    case TPL_VAR_GRAVITY_P:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_PLATO,
+               convertToPlato(_gravitySG));
+      break;
+    case TPL_VAR_GRAVITY_CORR_G:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_SG, corrGravitySG);
+      break;
+    case TPL_VAR_GRAVITY_CORR_P:
+      snprintf(buf, TPL_VALUE_SIZE, "%.*f", DECIMALS_PLATO,
+               convertToPlato(corrGravitySG));
+      break;
+    case TPL_VAR_GRAVITY_UNIT:
+      buf[0] = myConfig.getGravityFormat();
+      buf[1] = 0;
+      break;
+    case TPL_VAR_APP_VER:
+      value = CFG_APPVER;
+      break;
+    case TPL_VAR_APP_BUILD:
+      value = CFG_GITREV;
+      break;
+    default:
+      return "";
+  }
+
+  _value[var] = value;
+  _formatted |= 1ul << var;
+  return value;
+}
+
+void CompiledTemplate::clear() {
+  _text.clear();
+  _tokens.clear();
+  _size = 0;
+}
+
+void CompiledTemplate::compile(const char *tpl) {
+  clear();
+
+  auto addLiteral = [this](const char *s, size_t length) {
+    if (!length) return;
+    _tokens.push_back({static_cast<uint16_t>(_text.size()), TPL_VAR_LITERAL});
+    _text.insert(_text.end(), s, s + length);
+    _text.push_back(0);
+  };
+
+  const char *literal = tpl;
+  const char *p = tpl;
+  int vars = 0;
+
+  while ((p = strstr(p, "${")) != nullptr) {
+    const char *end = strchr(p, '}');
+    if (!end) break;
+
+    size_t length = end - p + 1;
+    int var = 0;
+
+    while (var < TPL_VAR_MAX && (strlen(TPL_VAR_KEYS[var]) != length ||
+                                 strncmp(TPL_VAR_KEYS[var], p, length)))
+      var++;
+
+    if (var == TPL_VAR_MAX) {  // Not a variable, keep it as text
+      p += 2;
+      continue;
+    }
+
+    addLiteral(literal, p - literal);
+    _tokens.push_back({0, static_cast<TemplateVar>(var)});
+    vars++;
+    p = literal = end + 1;
+  }
+
+  addLiteral(literal, strlen(literal));
+  _size = _text.size() + vars * TPL_VALUE_SIZE;
+}
+
+void CompiledTemplate::render(TemplateValues &values, String &doc) {
+  doc = "";
+  doc.reserve(_size);
+
+  for (const Token &t : _tokens) {
+    if (t.var == TPL_VAR_LITERAL)
+      doc += &_text[t.offset];
+    else
+      doc += values.get(t.var);
+  }
+
+  if (doc.length() > _size) _size = doc.length();
+}
+
+// EOF
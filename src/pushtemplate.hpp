@@ -0,0 +1,142 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_PUSHTEMPLATE_HPP_
+#define SRC_PUSHTEMPLATE_HPP_
+
+#include <Arduino.h>
+
+#include <vector>
+
+constexpr auto TPL_MDNS = "${mdns}";
+constexpr auto TPL_ID = "${id}";
+constexpr auto TPL_TOKEN = "${token}";
+constexpr auto TPL_TOKEN2 = "${token2}";
+constexpr auto TPL_SLEEP_INTERVAL = "${sleep-interval}";
+constexpr auto TPL_TEMP = "${temp}";
+constexpr auto TPL_TEMP_C = "${temp-c}";
+constexpr auto TPL_TEMP_F = "${temp-f}";
+constexpr auto TPL_TEMP_UNITS = "${temp-unit}";  // C or F
+constexpr auto TPL_BATTERY = "${battery}";
+constexpr auto TPL_BATTERY_PERCENT = "${battery-percent}";
+constexpr auto TPL_RSSI = "${rssi}";
+constexpr auto TPL_RUN_TIME = "${run-time}";
+constexpr auto TPL_ANGLE = "${angle}";
+constexpr auto TPL_TILT = "${tilt}";  // same as angle
+constexpr auto TPL_GRAVITY = "${gravity}";
+constexpr auto TPL_GRAVITY_G = "${gravity-sg}";
+constexpr auto TPL_GRAVITY_P = "${gravity-plato}";
+constexpr auto TPL_GRAVITY_CORR = "${corr-gravity}";
+constexpr auto TPL_GRAVITY_CORR_G = "${corr-gravity-sg}";
+constexpr auto TPL_GRAVITY_CORR_P = "${corr-gravity-plato}";
+constexpr auto TPL_GRAVITY_UNIT = "${gravity-unit}";  // G or P
+constexpr auto TPL_APP_VER = "${app-ver}";
+constexpr auto TPL_APP_BUILD = "${app-build}";
+
+// Same order as the keys in TPL_VAR_KEYS
+enum TemplateVar : uint8_t {
+  TPL_VAR_MDNS = 0,
+  TPL_VAR_ID,
+  TPL_VAR_TOKEN,
+  TPL_VAR_TOKEN2,
+  TPL_VAR_SLEEP_INTERVAL,
+  TPL_VAR_TEMP,
+  TPL_VAR_TEMP_C,
+  TPL_VAR_TEMP_F,
+  TPL_VAR_TEMP_UNITS,
+  TPL_VAR_BATTERY,
+  TPL_VAR_BATTERY_PERCENT,
+  TPL_VAR_RSSI,
+  TPL_VAR_RUN_TIME,
+  TPL_VAR_ANGLE,
+  TPL_VAR_TILT,
+  TPL_VAR_GRAVITY,
+  TPL_VAR_GRAVITY_G,
+  TPL_VAR_GRAVITY_P,
+  TPL_VAR_GRAVITY_CORR,
+  TPL_VAR_GRAVITY_CORR_G,
+  TPL_VAR_GRAVITY_CORR_P,
+  TPL_VAR_GRAVITY_UNIT,
+  TPL_VAR_APP_VER,
+  TPL_VAR_APP_BUILD,
+  TPL_VAR_MAX,
+  TPL_VAR_LITERAL = 0xff,
+};
+
+constexpr auto TPL_VALUE_SIZE = 16;  // Longest formatted number
+
+// The values of one reading. Each variable is formatted the first time a
+// template uses it and then reused for the rest of the template.
+class TemplateValues {
+ private:
+  float _angle;
+  float _gravitySG;
+  float _tempC;
+  float _battery;
+  int _interval;
+  const char *_id;
+  const char *_token;
+  const char *_name;
+
+  uint32_t _formatted = 0;
+  const char *_value[TPL_VAR_MAX];
+  char _buffer[TPL_VAR_MAX][TPL_VALUE_SIZE];
+
+  const char *format(TemplateVar var);
+
+ public:
+  TemplateValues(float angle, float gravitySG, float tempC, float battery,
+                 int interval, const char *id, const char *token,
+                 const char *name);
+
+  const char *get(TemplateVar var) {
+    if (_formatted & (1ul << var)) return _value[var];
+    return format(var);
+  }
+};
+
+// Template split into literal spans and variables when it's loaded, so that
+// rendering is one pass without searching for keys. Unknown ${...} keys are
+// kept as text.
+class CompiledTemplate {
+ private:
+  struct Token {
+    uint16_t offset;  // Start of the literal in _text
+    TemplateVar var;
+  };
+
+  std::vector<char> _text;  // Literal spans, each terminated with a nul
+  std::vector<Token> _tokens;
+  size_t _size = 0;  // Expected length of a rendered document
+
+ public:
+  void compile(const char *tpl);
+  void clear();
+
+  // The document keeps its buffer so it can be reused for the next render
+  void render(TemplateValues &values, String &doc);
+};
+
+#endif  // SRC_PUSHTEMPLATE_HPP_
+
+// EOF
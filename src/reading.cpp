@@ -0,0 +1,209 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <reading.hpp>
+
+#if defined(ENABLE_ARDUINOJSON_PARSER)
+#include <ArduinoJson.h>
+
+bool parseGravitymonReading(const char* json, size_t length,
+                            GravitymonReading& reading) {
+  DynamicJsonDocument in(1000);
+  DeserializationError err = deserializeJson(in, json, length);
+
+  if (err) return false;
+
+  memset(&reading, 0, sizeof(reading));
+  strlcpy(&reading.id[0], in[PARAM_BLE_ID] | "", sizeof(reading.id));
+  strlcpy(&reading.name[0], in[PARAM_BLE_NAME] | "", sizeof(reading.name));
+  strlcpy(&reading.token[0], in[PARAM_BLE_TOKEN] | "", sizeof(reading.token));
+  strlcpy(&reading.tempUnits[0], in[PARAM_BLE_TEMP_UNITS] | "",
+          sizeof(reading.tempUnits));
+  reading.temp = in[PARAM_BLE_TEMP].isNull()
+                     ? in[PARAM_BLE_TEMPERATURE].as<float>()
+                     : in[PARAM_BLE_TEMP].as<float>();
+  reading.gravity = in[PARAM_BLE_GRAVITY].as<float>();
+  reading.angle = in[PARAM_BLE_ANGLE].as<float>();
+  reading.battery = in[PARAM_BLE_BATTERY].as<float>();
+  reading.rssi = in[PARAM_BLE_RSSI].as<int>();
+  reading.interval = in[PARAM_BLE_INTERVAL].as<int>();
+  return reading.id[0] != 0;
+}
+
+#else
+
+static bool keyEquals(const char* key, size_t len, const char* name) {
+  return strlen(name) == len && !memcmp(key, name, len);
+}
+
+static void skipSpace(const char*& p, const char* end) {
+  while (p < end && isspace(static_cast<unsigned char>(*p))) p++;
+}
+
+// Returns the content of the string that p points to (without quotes)
+static bool readString(const char*& p, const char* end,
+                       const char** start, size_t* len) {
+  if (p >= end || *p != '"') return false;
+
+  *start = ++p;
+
+  while (p < end && *p != '"') {
+    if (*p == '\\') p++;
+    p++;
+  }
+
+  if (p >= end) return false;
+
+  *len = p++ - *start;
+  return true;
+}
+
+// Skip over a value we are not interested in (including objects and arrays)
+static bool skipValue(const char*& p, const char* end) {
+  int depth = 0;
+
+  while (p < end) {
+    if (*p == '"') {
+      const char* s;
+      size_t l;
+
+      if (!readString(p, end, &s, &l)) return false;
+      if (depth == 0) return true;
+      continue;
+    }
+
+    if (*p == '{' || *p == '[') {
+      depth++;
+    } else if (*p == '}' || *p == ']') {
+      if (depth == 0) return true;  // End of the reading object
+      if (--depth == 0) {
+        p++;
+        return true;
+      }
+    } else if (depth == 0 &&
+               (*p == ',' || isspace(static_cast<unsigned char>(*p)))) {
+      return true;
+    }
+
+    p++;
+  }
+
+  return false;
+}
+
+static void copyString(char* dest, size_t size, const char* src, size_t len) {
+  if (len >= size) len = size - 1;
+  memcpy(dest, src, len);
+  dest[len] = 0;
+}
+
+bool parseGravitymonReading(const char* json, size_t length,
+                            GravitymonReading& reading) {
+  const char* p = json;
+  const char* end = json + length;
+
+  memset(&reading, 0, sizeof(reading));
+
+  skipSpace(p, end);
+  if (p >= end || *p++ != '{') return false;
+
+  // A reading without an id can't be matched to a device
+  skipSpace(p, end);
+  if (p < end && *p == '}') return false;
+
+  while (p < end) {
+    const char* key;
+    size_t keyLen;
+
+    skipSpace(p, end);
+    if (!readString(p, end, &key, &keyLen)) return false;
+
+    skipSpace(p, end);
+    if (p >= end || *p++ != ':') return false;
+
+    skipSpace(p, end);
+    if (p >= end) return false;
+
+    if (*p == '"') {
+      const char* val;
+      size_t len;
+
+      if (!readString(p, end, &val, &len)) return false;
+
+      if (keyEquals(key, keyLen, PARAM_BLE_ID))
+        copyString(&reading.id[0], sizeof(reading.id), val, len);
+      else if (keyEquals(key, keyLen, PARAM_BLE_NAME))
+        copyString(&reading.name[0], sizeof(reading.name), val, len);
+      else if (keyEquals(key, keyLen, PARAM_BLE_TOKEN))
+        copyString(&reading.token[0], sizeof(reading.token), val, len);
+      else if (keyEquals(key, keyLen, PARAM_BLE_TEMP_UNITS))
+        copyString(&reading.tempUnits[0], sizeof(reading.tempUnits), val,
+                   len);
+    } else if (*p == '-' || isdigit(static_cast<unsigned char>(*p))) {
+      char num[24];
+      size_t len = 0;
+
+      while (p < end && len < sizeof(num) - 1 &&
+             (isdigit(static_cast<unsigned char>(*p)) || *p == '-' ||
+              *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+        num[len++] = *p++;
+      num[len] = 0;
+
+      float v = strtof(&num[0], nullptr);
+
+      if (keyEquals(key, keyLen, PARAM_BLE_TEMP) ||
+          keyEquals(key, keyLen, PARAM_BLE_TEMPERATURE))
+        reading.temp = v;
+      else if (keyEquals(key, keyLen, PARAM_BLE_GRAVITY))
+        reading.gravity = v;
+      else if (keyEquals(key, keyLen, PARAM_BLE_ANGLE))
+        reading.angle = v;
+      else if (keyEquals(key, keyLen, PARAM_BLE_BATTERY))
+        reading.battery = v;
+      else if (keyEquals(key, keyLen, PARAM_BLE_RSSI))
+        reading.rssi = static_cast<int>(v);
+      else if (keyEquals(key, keyLen, PARAM_BLE_INTERVAL))
+        reading.interval = static_cast<int>(v);
+    } else if (!skipValue(p, end)) {
+      return false;
+    }
+
+    skipSpace(p, end);
+    if (p >= end) return false;
+    if (*p == '}') return reading.id[0] != 0;
+    if (*p++ != ',') return false;
+
+    skipSpace(p, end);
+    if (p < end && *p == '}') return reading.id[0] != 0;  // Trailing comma
+  }
+
+  return false;
+}
+
+#endif
+
+// EOF
@@ -0,0 +1,67 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_READING_HPP_
+#define SRC_READING_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr auto PARAM_BLE_ID = "ID";
+constexpr auto PARAM_BLE_TEMP = "temp";
+constexpr auto PARAM_BLE_TEMPERATURE = "temperature";
+constexpr auto PARAM_BLE_GRAVITY = "gravity";
+constexpr auto PARAM_BLE_ANGLE = "angle";
+constexpr auto PARAM_BLE_BATTERY = "battery";
+constexpr auto PARAM_BLE_RSSI = "RSSI";
+constexpr auto PARAM_BLE_NAME = "name";
+constexpr auto PARAM_BLE_TOKEN = "token";
+constexpr auto PARAM_BLE_INTERVAL = "interval";
+constexpr auto PARAM_BLE_TEMP_UNITS = "temp_units";
+
+constexpr auto GRAVITYMON_ID_SIZE = 20;  // Chip id or name, with the nul
+
+// One reading from a gravitymon device as sent in the ExtBeacon / GATT json
+// payload. Kept on the stack so decoding does not touch the heap.
+struct GravitymonReading {
+  char id[GRAVITYMON_ID_SIZE];
+  char name[33];
+  char token[65];
+  char tempUnits[2];
+  float temp;  // Either "temp" (ExtBeacon) or "temperature" (GATT)
+  float gravity;
+  float angle;
+  float battery;
+  int rssi;
+  int interval;
+};
+
+// Parse the json payload in one pass without heap allocation, unknown keys
+// are skipped. Readings without an id are rejected. Build with
+// ENABLE_ARDUINOJSON_PARSER to use ArduinoJson instead.
+bool parseGravitymonReading(const char* json, size_t length,
+                            GravitymonReading& reading);
+
+#endif  // SRC_READING_HPP_
+
+// EOF
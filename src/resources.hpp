@@ -43,7 +43,12 @@ constexpr auto PARAM_IP = "ip";
 constexpr auto PARAM_WIFI_SETUP = "wifi_setup";
 constexpr auto PARAM_BLE_ACTIVE_SCAN = "ble_active_scan";
 constexpr auto PARAM_BLE_SCAN_TIME = "ble_scan_time";
+constexpr auto PARAM_BLE_NOTIFY = "ble_notify";
+constexpr auto PARAM_BLE_ADAPTIVE_SCAN = "ble_adaptive_scan";
+constexpr auto PARAM_BLE_CODED_PHY = "ble_coded_phy";
+constexpr auto PARAM_BLE_ACCEPT_LIST = "ble_accept_list";
 constexpr auto PARAM_PUSH_RESEND_TIME = "push_resend_time";
+constexpr auto PARAM_DEVICE_CAPACITY = "device_capacity";
 constexpr auto PARAM_TIMEZONE = "timezone";
 constexpr auto PARAM_GRAVITY_DEVICE = "gravity_device";
 constexpr auto PARAM_DEVICE = "device";
@@ -56,5 +61,52 @@ constexpr auto PARAM_UPTIME_SECONDS = "uptime_seconds";
 constexpr auto PARAM_UPTIME_MINUTES = "uptime_minutes";
 constexpr auto PARAM_UPTIME_HOURS = "uptime_hours";
 constexpr auto PARAM_UPTIME_DAYS = "uptime_days";
+constexpr auto PARAM_BLE_ADVERT_OVERFLOW = "ble_advert_overflow";
+constexpr auto PARAM_BLE_ADVERT_HIGH_WATER = "ble_advert_high_water";
+constexpr auto PARAM_BLE_ADVERT_CACHE_HITS = "ble_advert_cache_hits";
+constexpr auto PARAM_BLE_ADVERT_CACHE_MISSES = "ble_advert_cache_misses";
+constexpr auto PARAM_BLE_ADVERTS_IGNORED = "ble_adverts_ignored";
+constexpr auto PARAM_BLE_DEVICE_CAPACITY = "ble_device_capacity";
+constexpr auto PARAM_BLE_DEVICE_COUNT = "ble_device_count";
+constexpr auto PARAM_BLE_DEVICE_EVICTIONS = "ble_device_evictions";
+constexpr auto PARAM_WIFI_DEVICE_CAPACITY = "wifi_device_capacity";
+constexpr auto PARAM_WIFI_DEVICE_COUNT = "wifi_device_count";
+constexpr auto PARAM_WIFI_DEVICE_EVICTIONS = "wifi_device_evictions";
+constexpr auto PARAM_BLE_SCAN_DUTY = "ble_scan_duty";
+constexpr auto PARAM_BLE_ACTIVE_WINDOWS = "ble_active_windows";
+constexpr auto PARAM_BLE_MAC_CLASSIFIED = "ble_mac_classified";
+constexpr auto PARAM_BLE_CALLBACK_TIME = "ble_callback_time";
+constexpr auto PARAM_BLE_ADVERT_RATE_OPEN = "ble_advert_rate_open";
+constexpr auto PARAM_BLE_ADVERT_RATE_FILTERED = "ble_advert_rate_filtered";
+constexpr auto PARAM_BLE_HOST_CPU_SAVED = "ble_host_cpu_saved";
+constexpr auto PARAM_BLE_EXTENDED_ADVERTS = "ble_extended_adverts";
+constexpr auto PARAM_BLE_CODED_ADVERTS = "ble_coded_adverts";
+constexpr auto PARAM_PUSH_SLOT_COUNT = "push_slot_count";
+constexpr auto PARAM_PUSH_SLOT_PUSHES = "push_slot_pushes";
+constexpr auto PARAM_PUSH_SLOT_TIME = "push_slot_time";
+constexpr auto PARAM_PUSH_SLOT_WAIT = "push_slot_wait";
+constexpr auto PARAM_BLE_SESSIONS = "ble_sessions";
+constexpr auto PARAM_ADDRESS = "address";
+constexpr auto PARAM_STATE = "state";
+constexpr auto PARAM_RECONNECTS = "reconnects";
+constexpr auto PARAM_NOTIFICATIONS = "notifications";
+constexpr auto PARAM_NOTIFY_RATE = "notify_rate";
+constexpr auto PARAM_TASKS = "tasks";
+constexpr auto PARAM_TASK_NAME = "name";
+constexpr auto PARAM_TASK_CORE = "core";
+constexpr auto PARAM_TASK_STACK_FREE = "stack_free";
+constexpr auto PARAM_TASK_BUSY = "busy";
+constexpr auto PARAM_MQTT_CONNECTED = "mqtt_connected";
+constexpr auto PARAM_MQTT_RECONNECTS = "mqtt_reconnects";
+constexpr auto PARAM_MQTT_FAILURES = "mqtt_failures";
+constexpr auto PARAM_MQTT_PUBLISHES = "mqtt_publishes";
+constexpr auto PARAM_MQTT_PUBLISH_TIME = "mqtt_publish_time";
+constexpr auto PARAM_PUSH_TARGETS = "push_targets";
+constexpr auto PARAM_PUSH_TARGET_NAME = "name";
+constexpr auto PARAM_PUSH_SENT = "sent";
+constexpr auto PARAM_PUSH_FAILED = "failed";
+constexpr auto PARAM_PUSH_DROPPED = "dropped";
+constexpr auto PARAM_PUSH_AVG_TIME = "avg_time";
+constexpr auto PARAM_PUSH_LAST_CODE = "last_code";
 
 #endif  // SRC_RESOURCES_HPP_
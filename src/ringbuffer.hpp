@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_RINGBUFFER_HPP_
+#define SRC_RINGBUFFER_HPP_
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Lock free ring buffer for one producer and one consumer. Entries are written
+// and read in place so the producer can fill a slot without an extra copy.
+// The size must be a power of two.
+template <typename T, uint32_t N>
+class RingBuffer {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Size must be a power of two");
+
+ private:
+  T _entries[N];
+  std::atomic<uint32_t> _head{0};  // Written by producer
+  std::atomic<uint32_t> _tail{0};  // Written by consumer
+  std::atomic<uint32_t> _overflow{0};
+  std::atomic<uint32_t> _highWater{0};
+
+ public:
+  // Producer side, returns nullptr when the buffer is full.
+  T* acquire() {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t used = head - _tail.load(std::memory_order_acquire);
+
+    if (used >= N) {
+      _overflow.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    if (used + 1 > _highWater.load(std::memory_order_relaxed))
+      _highWater.store(used + 1, std::memory_order_relaxed);
+
+    return &_entries[head & (N - 1)];
+  }
+
+  void commit() {
+    _head.store(_head.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // Consumer side, returns nullptr when the buffer is empty.
+  T* peek() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail == _head.load(std::memory_order_acquire)) return nullptr;
+
+    return &_entries[tail & (N - 1)];
+  }
+
+  void release() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  uint32_t size() const {
+    return _head.load(std::memory_order_acquire) -
+           _tail.load(std::memory_order_acquire);
+  }
+  uint32_t capacity() const { return N; }
+  uint32_t getOverflow() const {
+    return _overflow.load(std::memory_order_relaxed);
+  }
+  uint32_t getHighWater() const {
+    return _highWater.load(std::memory_order_relaxed);
+  }
+};
+
+#endif  // SRC_RINGBUFFER_HPP_
+
+// EOF
@@ -0,0 +1,103 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_SEQLOCK_HPP_
+#define SRC_SEQLOCK_HPP_
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+// Value that can be read from another task without locks. The sequence is odd
+// while a write is in progress and readers retry until they get a copy taken
+// between two equal even sequence numbers. Writers are serialized on the
+// sequence so two tasks can publish the same value.
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Value must be trivially copyable");
+
+ private:
+  static constexpr int SPINS = 64;  // Before giving the other task some time
+
+  std::atomic<uint32_t> _seq{0};
+  T _value{};
+
+  // A preempted writer on the same core needs to run before we can continue
+  static void backoff(int &spins) {
+    if (++spins > SPINS) {
+      vTaskDelay(1);
+      spins = 0;
+    }
+  }
+
+ public:
+  Seqlock() = default;
+  Seqlock(const Seqlock &other) { other.read(_value); }
+  Seqlock &operator=(const Seqlock &other) {
+    if (this != &other) {
+      T value;
+      other.read(value);
+      write(value);
+    }
+    return *this;
+  }
+
+  void write(const T &value) {
+    uint32_t seq = _seq.load(std::memory_order_relaxed);
+    int spins = 0;
+
+    while ((seq & 1) || !_seq.compare_exchange_weak(
+                            seq, seq + 1, std::memory_order_relaxed)) {
+      backoff(spins);
+      seq = _seq.load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&_value, &value, sizeof(T));
+    _seq.store(seq + 2, std::memory_order_release);
+  }
+
+  void read(T &value) const {
+    int spins = 0;
+
+    while (true) {
+      uint32_t seq = _seq.load(std::memory_order_acquire);
+
+      if (!(seq & 1)) {
+        memcpy(&value, &_value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_seq.load(std::memory_order_relaxed) == seq) return;
+      }
+
+      backoff(spins);
+    }
+  }
+};
+
+#endif  // SRC_SEQLOCK_HPP_
+
+// EOF
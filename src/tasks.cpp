@@ -0,0 +1,62 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <esp_timer.h>
+
+#include <tasks.hpp>
+
+constexpr auto TASK_BUSY_WINDOW = 5000000;  // us
+
+TaskMonitor myTasks;
+
+void TaskMonitor::add(TaskId id, const char *name, TaskHandle_t handle,
+                      int core) {
+  TaskStats &t = _tasks[id];
+  t.name = name;
+  t.handle = handle;
+  t.core = core;
+  t.window = esp_timer_get_time();
+}
+
+void TaskMonitor::begin(TaskId id) { _tasks[id].start = esp_timer_get_time(); }
+
+void TaskMonitor::end(TaskId id) {
+  TaskStats &t = _tasks[id];
+  uint64_t now = esp_timer_get_time();
+
+  t.elapsed += now - t.start;
+
+  if (now - t.window > TASK_BUSY_WINDOW) {
+    t.busy.store(t.elapsed * 100 / (now - t.window));
+    t.elapsed = 0;
+    t.window = now;
+  }
+}
+
+uint32_t TaskMonitor::getStackFree(TaskId id) {
+  // On ESP-IDF the high water mark is in bytes
+  return _tasks[id].handle ? uxTaskGetStackHighWaterMark(_tasks[id].handle)
+                           : 0;
+}
+
+// EOF
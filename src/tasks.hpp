@@ -0,0 +1,85 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_TASKS_HPP_
+#define SRC_TASKS_HPP_
+
+#include <Arduino.h>
+
+#include <atomic>
+
+// Tasks are pinned so BLE ingest has a core of its own on dual core chips
+#if CONFIG_FREERTOS_UNICORE
+constexpr auto TASK_CORE_BLE = 0;
+constexpr auto TASK_CORE_APP = 0;
+#else
+constexpr auto TASK_CORE_BLE = 0;  // Same core as the NimBLE host task
+constexpr auto TASK_CORE_APP = 1;  // Arduino loop (web, display) and push
+#endif
+
+// One id for each of the PUSH_WORKERS push workers
+enum TaskId {
+  TASK_LOOP = 0,
+  TASK_BLE = 1,
+  TASK_PUSH = 2,
+  TASK_PUSH_WORKER1 = 3,
+  TASK_PUSH_WORKER2 = 4,
+  TASK_MAX = 5
+};
+
+// Measures how much of the wall clock time a task spends between begin() and
+// end(), updated every few seconds. This includes time blocked on I/O or
+// preempted, so it is not the cpu usage of the task.
+struct TaskStats {
+  const char *name = "";
+  TaskHandle_t handle = nullptr;
+  int core = 0;
+  uint64_t start = 0;
+  uint64_t elapsed = 0;
+  uint64_t window = 0;
+  std::atomic<uint8_t> busy{0};
+};
+
+class TaskMonitor {
+ private:
+  TaskStats _tasks[TASK_MAX];
+
+ public:
+  void add(TaskId id, const char *name, TaskHandle_t handle, int core);
+
+  // Call around the work done in each iteration of the task loop
+  void begin(TaskId id);
+  void end(TaskId id);
+
+  bool isActive(TaskId id) { return _tasks[id].handle != nullptr; }
+  const char *getName(TaskId id) { return _tasks[id].name; }
+  int getCore(TaskId id) { return _tasks[id].core; }
+  uint8_t getBusy(TaskId id) { return _tasks[id].busy.load(); }  // Percent
+  uint32_t getStackFree(TaskId id);  // Bytes never used
+};
+
+extern TaskMonitor myTasks;
+
+#endif  // SRC_TASKS_HPP_
+
+// EOF
@@ -0,0 +1,73 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_TILTBEACON_HPP_
+#define SRC_TILTBEACON_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read big endian integers directly from the advertisement bytes
+inline uint16_t readUint16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+inline uint32_t readUint32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+         p[3];
+}
+
+// Fields of a Tilt iBeacon. The payload is the "manufacturer data" part of
+// the advert:
+//
+// 4c000215a495bb40c5b14b44b5121370f02d74de005004d9c5
+// ????????iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiittttggggXR
+//
+// Bytes 4 - 19 contain the uuid that identifies the color.
+struct TiltBeacon {
+  uint16_t temp;     // F, F * 10 for Tilt Pro
+  uint16_t gravity;  // SG * 1000, SG * 10000 for Tilt Pro
+  uint8_t txPower;   // Used by recent tilts to indicate battery age
+
+  bool isPro() const { return gravity >= 5000; }
+  float getGravity() const {
+    return gravity / static_cast<float>(isPro() ? 10000 : 1000);
+  }
+  float getTempF() const {
+    return temp / static_cast<float>(isPro() ? 10 : 1);
+  }
+};
+
+// Returns false if the payload is not an iBeacon, the uuid is not checked
+inline bool decodeTiltBeacon(const uint8_t *payload, size_t length,
+                             TiltBeacon *beacon) {
+  if (length < 24 || payload[0] != 0x4c || payload[1] != 0x00 ||
+      payload[2] != 0x02 || payload[3] != 0x15)
+    return false;
+
+  beacon->temp = readUint16(payload + 20);
+  beacon->gravity = readUint16(payload + 22);
+  beacon->txPower = length > 24 ? payload[24] : 0;
+  return true;
+}
+
+#endif  // SRC_TILTBEACON_HPP_
+
+// EOF
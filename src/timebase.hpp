@@ -0,0 +1,56 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef SRC_TIMEBASE_HPP_
+#define SRC_TIMEBASE_HPP_
+
+#include <esp_timer.h>
+#include <stdint.h>
+#include <time.h>
+
+// Monotonic milliseconds since boot, 64 bits so it will not wrap. Readings
+// store this and the wall clock time is only calculated when it's shown.
+inline uint64_t getTimestamp() { return esp_timer_get_time() / 1000; }
+
+// Convert a timestamp to local wall clock time. Returns false if the clock
+// has not been synced yet (the time is then relative to 1970).
+inline bool timestampToLocalTime(uint64_t timestamp, struct tm *info) {
+  time_t now = time(nullptr);
+  time_t t = now - static_cast<time_t>((getTimestamp() - timestamp) / 1000);
+
+  localtime_r(&t, info);
+  return info->tm_year > (2016 - 1900);
+}
+
+// Wall clock time of a timestamp in seconds since epoch, 0 if the clock has
+// not been synced yet.
+inline time_t timestampToEpoch(uint64_t timestamp) {
+  time_t t = time(nullptr) -
+             static_cast<time_t>((getTimestamp() - timestamp) / 1000);
+
+  return t >= 1483228800 ? t : 0;  // 2017-01-01
+}
+
+#endif  // SRC_TIMEBASE_HPP_
+
+// EOF
@@ -29,12 +29,15 @@ SOFTWARE.
 #include <config.hpp>
 #include <helper.hpp>
 #include <main.hpp>
+#include <pushdispatcher.hpp>
 #include <pushtarget.hpp>
 #include <resources.hpp>
-#include <templating.hpp>
+#include <tasks.hpp>
 #include <uptime.hpp>
 #include <webserver.hpp>
 
+#include <algorithm>
+
 GravmonGatewayWebServer::GravmonGatewayWebServer(WebConfig *config)
     : BaseWebServer(config) {}
 
@@ -88,6 +91,7 @@ void GravmonGatewayWebServer::webHandleFactoryDefaults(
   LittleFS.remove(TPL_FNAME_INFLUXDB);
   LittleFS.remove(TPL_FNAME_MQTT);
   LittleFS.end();
+  GravmonGatewayPush::invalidateTemplates();
   Log.notice(F("WEB : Deleted files in filesystem, rebooting." CR));
 
   AsyncJsonResponse *response =
@@ -101,6 +105,15 @@ void GravmonGatewayWebServer::webHandleFactoryDefaults(
   _rebootTask = true;  
 }
 
+// Size of one entry in the status lists, strings that are copied are added
+constexpr auto STATUS_DEVICE_SIZE =
+    JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(6) + 20;
+constexpr auto STATUS_SESSION_SIZE =
+    JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(5) + 18;
+constexpr auto STATUS_TASK_SIZE = JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(4);
+constexpr auto STATUS_TARGET_SIZE = JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(6);
+constexpr auto STATUS_DEVICE_SLACK = 4;
+
 void GravmonGatewayWebServer::webHandleStatus(AsyncWebServerRequest *request) {
   Log.notice(F("WEB : webServer callback for /api/status(get)." CR));
 
@@ -112,8 +125,20 @@ void GravmonGatewayWebServer::webHandleStatus(AsyncWebServerRequest *request) {
     ESP_RESET();
   }
 
-  AsyncJsonResponse *response =
-      new AsyncJsonResponse(false, JSON_BUFFER_SIZE_L);
+  // The fixed part fits in JSON_BUFFER_SIZE_L, the lists are added on top.
+  // Devices can be registered while the response is built, so there is room
+  // for a few more than the current count.
+  int deviceSlots =
+      std::min(bleScanner.getGravitymonCount() + STATUS_DEVICE_SLACK,
+               bleScanner.getGravitymonCapacity()) +
+      std::min(getGravitymonCount() + STATUS_DEVICE_SLACK,
+               getGravitymonCapacity());
+  size_t size = JSON_BUFFER_SIZE_L + deviceSlots * STATUS_DEVICE_SIZE +
+                bleScanner.getNotifySessionCount() * STATUS_SESSION_SIZE +
+                TASK_MAX * STATUS_TASK_SIZE +
+                GravmonGatewayPush::TEMPLATE_MAX * STATUS_TARGET_SIZE;
+
+  AsyncJsonResponse *response = new AsyncJsonResponse(false, size);
   JsonObject obj = response->getRoot().as<JsonObject>();
 
   obj[PARAM_ID] = myConfig.getID();
@@ -141,34 +166,118 @@ void GravmonGatewayWebServer::webHandleStatus(AsyncWebServerRequest *request) {
   obj[PARAM_UPTIME_HOURS] = myUptime.getHours();
   obj[PARAM_UPTIME_DAYS] = myUptime.getDays();
 
+  obj[PARAM_BLE_ADVERT_OVERFLOW] = bleScanner.getAdvertOverflow();
+  obj[PARAM_BLE_ADVERT_HIGH_WATER] = bleScanner.getAdvertHighWater();
+  obj[PARAM_BLE_ADVERT_CACHE_HITS] = bleScanner.getAdvertCacheHits();
+  obj[PARAM_BLE_ADVERT_CACHE_MISSES] = bleScanner.getAdvertCacheMisses();
+  obj[PARAM_BLE_ADVERTS_IGNORED] = bleScanner.getAdvertsIgnored();
+  obj[PARAM_BLE_SCAN_DUTY] = bleScanner.getScanDuty();
+  obj[PARAM_BLE_ACTIVE_WINDOWS] = bleScanner.getActiveWindows();
+  obj[PARAM_BLE_MAC_CLASSIFIED] = bleScanner.getMacClassified();
+  obj[PARAM_BLE_CALLBACK_TIME] = bleScanner.getCallbackTime();
+  obj[PARAM_BLE_ADVERT_RATE_OPEN] = bleScanner.getAdvertRate(false);
+  obj[PARAM_BLE_ADVERT_RATE_FILTERED] = bleScanner.getAdvertRate(true);
+  obj[PARAM_BLE_HOST_CPU_SAVED] = bleScanner.getHostCpuSaved();
+  obj[PARAM_BLE_EXTENDED_ADVERTS] = bleScanner.getExtendedAdverts();
+  obj[PARAM_BLE_CODED_ADVERTS] = bleScanner.getCodedAdverts();
+  obj[PARAM_PUSH_SLOT_COUNT] = bleScanner.getPushSlotCount();
+  obj[PARAM_PUSH_SLOT_PUSHES] = bleScanner.getPushSlotPushes();
+  obj[PARAM_PUSH_SLOT_TIME] = bleScanner.getPushSlotTime();
+  obj[PARAM_PUSH_SLOT_WAIT] = bleScanner.getPushSlotWait();
+  obj[PARAM_MQTT_CONNECTED] = myMqtt.isConnected();
+  obj[PARAM_MQTT_RECONNECTS] = myMqtt.getReconnects();
+  obj[PARAM_MQTT_FAILURES] = myMqtt.getFailures();
+  obj[PARAM_MQTT_PUBLISHES] = myMqtt.getPublishes();
+  obj[PARAM_MQTT_PUBLISH_TIME] = myMqtt.getPublishTime();
+
+  obj[PARAM_DEVICE_CAPACITY] = myConfig.getDeviceCapacity();
+  obj[PARAM_BLE_DEVICE_CAPACITY] = bleScanner.getGravitymonCapacity();
+  obj[PARAM_BLE_DEVICE_COUNT] = bleScanner.getGravitymonCount();
+  obj[PARAM_BLE_DEVICE_EVICTIONS] = bleScanner.getGravitymonEvictions();
+  obj[PARAM_WIFI_DEVICE_CAPACITY] = getGravitymonCapacity();
+  obj[PARAM_WIFI_DEVICE_COUNT] = getGravitymonCount();
+  obj[PARAM_WIFI_DEVICE_EVICTIONS] = getGravitymonEvictions();
+
+  static const char *const states[] = {"free", "connecting", "connected",
+                                       "disconnected", "unsupported"};
+  JsonArray sessions = obj.createNestedArray(PARAM_BLE_SESSIONS);
+
+  for (int i = 0; i < bleScanner.getNotifySessionCount(); i++) {
+    BleSessionSnapshot s;
+    bleScanner.getNotifySessionSnapshot(i, s);
+
+    char address[18];  // Same format as NimBLEAddress::toString()
+    for (int b = 0; b < 6; b++)
+      snprintf(&address[b * 3], sizeof(address) - b * 3,
+               b < 5 ? "%02x:" : "%02x",
+               static_cast<uint8_t>(s.mac >> (40 - b * 8)));
+
+    JsonObject n = sessions.createNestedObject();
+    n[PARAM_ADDRESS] = address;
+    n[PARAM_STATE] = states[s.state];
+    n[PARAM_RECONNECTS] = s.getReconnects();
+    n[PARAM_NOTIFICATIONS] = s.notifications;
+    n[PARAM_NOTIFY_RATE] = s.getNotifyRate();
+  }
+
+  JsonArray tasks = obj.createNestedArray(PARAM_TASKS);
+
+  for (int i = 0; i < TASK_MAX; i++) {
+    TaskId id = static_cast<TaskId>(i);
+    if (!myTasks.isActive(id)) continue;
+
+    JsonObject n = tasks.createNestedObject();
+    n[PARAM_TASK_NAME] = myTasks.getName(id);
+    n[PARAM_TASK_CORE] = myTasks.getCore(id);
+    n[PARAM_TASK_STACK_FREE] = myTasks.getStackFree(id);
+    n[PARAM_TASK_BUSY] = myTasks.getBusy(id);
+  }
+
+  JsonArray targets = obj.createNestedArray(PARAM_PUSH_TARGETS);
+
+  for (int i = 0; i < GravmonGatewayPush::TEMPLATE_MAX; i++) {
+    PushTargetQueue &w = myPush.getTarget(i);
+    if (!GravmonGatewayPush::isTargetEnabled(w.target)) continue;
+
+    JsonObject n = targets.createNestedObject();
+    n[PARAM_PUSH_TARGET_NAME] = PUSH_TARGET_LIMITS[i].name;
+    n[PARAM_PUSH_SENT] = w.sent.load();
+    n[PARAM_PUSH_FAILED] = w.failed.load();
+    n[PARAM_PUSH_DROPPED] = w.dropped.load();
+    n[PARAM_PUSH_AVG_TIME] = w.getTime();
+    n[PARAM_PUSH_LAST_CODE] = w.lastCode.load();
+  }
+
   JsonArray devices = obj.createNestedArray(PARAM_GRAVITY_DEVICE);
 
   // Get data from BLE
-  for (int i = 0; i < NO_GRAVITYMON; i++) {
-    GravitymonData gd = bleScanner.getGravitymonData(i);
-    if (gd.id != "") {
-      JsonObject n = devices.createNestedObject();
-      n[PARAM_DEVICE] = gd.id;
-      n[PARAM_GRAVITY] = gd.gravity;
-      n[PARAM_TEMP] = gd.tempC;
-      n[PARAM_UPDATE_TIME] = gd.getUpdateAge();
-      n[PARAM_PUSH_TIME] = gd.getPushAge();
-      n[PARAM_ENDPOINT] = "ble";
-    }
+  for (int i = 0; i < bleScanner.getGravitymonCount(); i++) {
+    GravitymonSnapshot gd;
+    bleScanner.getGravitymonSnapshot(i, gd);
+    if (!gd.id[0]) continue;  // Not published yet
+
+    JsonObject n = devices.createNestedObject();
+    n[PARAM_DEVICE] = gd.id;
+    n[PARAM_GRAVITY] = gd.gravity;
+    n[PARAM_TEMP] = gd.tempC;
+    n[PARAM_UPDATE_TIME] = gd.getUpdateAge();
+    n[PARAM_PUSH_TIME] = gd.getPushAge();
+    n[PARAM_ENDPOINT] = "ble";
   }
 
   // Get data from WIFI
-  for (int i = 0; i < NO_GRAVITYMON; i++) {
-    GravitymonData gd = getGravitymonData(i);
-    if (gd.id != "") {
-      JsonObject n = devices.createNestedObject();
-      n[PARAM_DEVICE] = gd.id;
-      n[PARAM_GRAVITY] = gd.gravity;
-      n[PARAM_TEMP] = gd.tempC;
-      n[PARAM_UPDATE_TIME] = gd.getUpdateAge();
-      n[PARAM_PUSH_TIME] = gd.getPushAge();
-      n[PARAM_ENDPOINT] = "wifi";
-    }
+  for (int i = 0; i < getGravitymonCount(); i++) {
+    GravitymonSnapshot gd;
+    getGravitymonSnapshot(i, gd);
+    if (!gd.id[0]) continue;  // Not published yet
+
+    JsonObject n = devices.createNestedObject();
+    n[PARAM_DEVICE] = gd.id;
+    n[PARAM_GRAVITY] = gd.gravity;
+    n[PARAM_TEMP] = gd.tempC;
+    n[PARAM_UPDATE_TIME] = gd.getUpdateAge();
+    n[PARAM_PUSH_TIME] = gd.getPushAge();
+    n[PARAM_ENDPOINT] = "wifi";
   }
 
   response->setLength();
@@ -203,6 +312,8 @@ void GravmonGatewayWebServer::webHandleConfigFormatWrite(
     success += writeFile(TPL_FNAME_MQTT, obj[PARAM_FORMAT_MQTT]) ? 1 : 0;
   }
 
+  GravmonGatewayPush::invalidateTemplates();
+
   AsyncJsonResponse *response =
       new AsyncJsonResponse(false, JSON_BUFFER_SIZE_S);
   obj = response->getRoot().as<JsonObject>();
@@ -254,58 +365,71 @@ void GravmonGatewayWebServer::webHandleRemotePost(
     "RSSI": -79
   }*/
 
-  String id =
-      obj.containsKey(PARAM_BLE_ID) ? obj[PARAM_BLE_ID].as<String>() : "";
-  String token =
-      obj.containsKey(PARAM_BLE_TOKEN) ? obj[PARAM_BLE_TOKEN].as<String>() : "";
-  String name =
-      obj.containsKey(PARAM_BLE_NAME) ? obj[PARAM_BLE_NAME].as<String>() : "";
-  int interval = obj.containsKey(PARAM_BLE_INTERVAL)
-                     ? obj[PARAM_BLE_INTERVAL].as<int>()
-                     : 0;
-  float temp = obj.containsKey(PARAM_BLE_TEMPERATURE)
-                   ? obj[PARAM_BLE_TEMPERATURE].as<float>()
-                   : 0.0;
-  String tempUnits = obj.containsKey(PARAM_BLE_TEMP_UNITS)
-                         ? obj[PARAM_BLE_TEMP_UNITS].as<String>()
-                         : "";
-  float gravity = obj.containsKey(PARAM_BLE_GRAVITY)
-                      ? obj[PARAM_BLE_GRAVITY].as<float>()
-                      : 0.0;
-  float angle =
-      obj.containsKey(PARAM_BLE_ANGLE) ? obj[PARAM_BLE_ANGLE].as<float>() : 0.0;
-  float battery = obj.containsKey(PARAM_BLE_BATTERY)
-                      ? obj[PARAM_BLE_BATTERY].as<float>()
-                      : 0.0;
-  int rssi =
-      obj.containsKey(PARAM_BLE_RSSI) ? obj[PARAM_BLE_RSSI].as<int>() : 0;
-
-  int idx = findGravitymonId(id);
-  if (idx >= 0) {
-    GravitymonData &data = getGravitymonData(idx);
-    Log.info(F("Web : Received post from %s." CR), id.c_str());
-
-    if (tempUnits == "C")
-      data.tempC = temp;
-    else
-      data.tempC = convertFtoC(temp);
-    data.gravity = gravity;
-    data.angle = angle;
-    data.battery = battery;
-    data.id = id;
-    data.name = name;
-    data.interval = interval;
-    data.token = token;
-    data.rssi = rssi;
-    // data.address = "";
-    data.type = "Http";
-    data.setUpdated();
-    request->send(200);
-  } else {
-    Log.error(F("Web : Max devices reached - no more devices available." CR));
+  HttpReading r;
+  GravitymonReading &reading = r.reading;
+
+  memset(&r, 0, sizeof(r));
+  r.timestamp = getTimestamp();
+  strlcpy(&reading.id[0], obj[PARAM_BLE_ID] | "", sizeof(reading.id));
+  strlcpy(&reading.name[0], obj[PARAM_BLE_NAME] | "", sizeof(reading.name));
+  strlcpy(&reading.token[0], obj[PARAM_BLE_TOKEN] | "", sizeof(reading.token));
+  strlcpy(&reading.tempUnits[0], obj[PARAM_BLE_TEMP_UNITS] | "",
+          sizeof(reading.tempUnits));
+  reading.interval = obj[PARAM_BLE_INTERVAL].as<int>();
+  reading.temp = obj[PARAM_BLE_TEMPERATURE].as<float>();
+  reading.gravity = obj[PARAM_BLE_GRAVITY].as<float>();
+  reading.angle = obj[PARAM_BLE_ANGLE].as<float>();
+  reading.battery = obj[PARAM_BLE_BATTERY].as<float>();
+  reading.rssi = obj[PARAM_BLE_RSSI].as<int>();
+
+  if (!reading.id[0]) {
+    Log.error(F("Web : Post without a device id." CR));
+    request->send(422);
+    return;
   }
 
-  request->send(422);
+  // The device table is updated by the BLE task, see processReadings()
+  if (!_readingQueue || xQueueSend(_readingQueue, &r, 0) != pdTRUE) {
+    Log.error(F("Web : Reading queue is full, dropping post from %s." CR),
+              &reading.id[0]);
+    request->send(422);
+    return;
+  }
+
+  Log.info(F("Web : Received post from %s." CR), &reading.id[0]);
+  request->send(200);
+}
+
+// Readings are posted from the web server task. The device table is only
+// changed here, from the BLE task, so it never changes while the controller
+// iterates it.
+void GravmonGatewayWebServer::processReadings() {
+  HttpReading r;
+
+  while (_readingQueue && xQueueReceive(_readingQueue, &r, 0) == pdTRUE) {
+    const GravitymonReading &reading = r.reading;
+    int idx = findGravitymonId(&reading.id[0]);
+
+    if (idx < 0) {
+      Log.error(
+          F("Web : Max devices reached - no more devices available." CR));
+      continue;
+    }
+
+    GravitymonData &data = getGravitymonData(idx);
+    data.setValues(reading.gravity,
+                   !strcmp(&reading.tempUnits[0], "C")
+                       ? reading.temp
+                       : convertFtoC(reading.temp),
+                   reading.angle, reading.battery);
+    if (!data.id[0]) strlcpy(&data.id[0], &reading.id[0], sizeof(data.id));
+    strlcpy(&data.name[0], &reading.name[0], sizeof(data.name));
+    data.setInterval(reading.interval);
+    strlcpy(&data.token[0], &reading.token[0], sizeof(data.token));
+    data.rssi = reading.rssi;
+    data.source = GRAVITYMON_SOURCE_HTTP;
+    data.setUpdated(r.timestamp);
+  }
 }
 
 void GravmonGatewayWebServer::webHandleTestPushStatus(
@@ -402,6 +526,10 @@ void GravmonGatewayWebServer::webHandleConfigFormatRead(
 bool GravmonGatewayWebServer::setupWebServer() {
   Log.notice(F("WEB : Configuring web server." CR));
 
+  Log.notice(F("WEB : Allocated room for %d devices." CR),
+             _gravitymon.init(myConfig.getDeviceCapacity()));
+  _readingQueue = xQueueCreate(HTTP_READING_QUEUE_SIZE, sizeof(HttpReading));
+
   BaseWebServer::setupWebServer();
   MDNS.addService("gravitymon", "tcp", 80);
 
@@ -456,59 +584,46 @@ bool GravmonGatewayWebServer::setupWebServer() {
 void GravmonGatewayWebServer::loop() {
   BaseWebServer::loop();
 
-  if (_pushTestTask) {
+  if (_pushTestTask && !_pushTestQueued) {
     Log.notice(F("WEB : Running scheduled push test for %s" CR),
                _pushTestTarget.c_str());
 
-    TemplatingEngine engine;
-    GravmonGatewayPush push(&myConfig);
-    push.setupTemplateEngine(engine, 45, 1.030, 22.1, 4.12, 900,
-                             myConfig.getID(), myConfig.getToken(),
-                             myConfig.getMDNS());
-
-    if (!_pushTestTarget.compareTo(PARAM_FORMAT_POST) &&
-        myConfig.hasTargetHttpPost()) {
-      String tpl = push.getTemplate(GravmonGatewayPush::TEMPLATE_HTTP1);
-      String doc = engine.create(tpl.c_str());
-      push.sendHttpPost(doc);
-      _pushTestEnabled = true;
-    } else if (!_pushTestTarget.compareTo(PARAM_FORMAT_POST2) &&
-               myConfig.hasTargetHttpPost2()) {
-      String tpl = push.getTemplate(GravmonGatewayPush::TEMPLATE_HTTP2);
-      String doc = engine.create(tpl.c_str());
-      push.sendHttpPost2(doc);
-      _pushTestEnabled = true;
-    } else if (!_pushTestTarget.compareTo(PARAM_FORMAT_GET) &&
-               myConfig.hasTargetHttpGet()) {
-      String tpl = push.getTemplate(GravmonGatewayPush::TEMPLATE_HTTP3);
-      String doc = engine.create(tpl.c_str());
-      push.sendHttpGet(doc);
-      _pushTestEnabled = true;
-    } else if (!_pushTestTarget.compareTo(PARAM_FORMAT_INFLUXDB) &&
-               myConfig.hasTargetInfluxDb2()) {
-      String tpl = push.getTemplate(GravmonGatewayPush::TEMPLATE_INFLUX);
-      String doc = engine.create(tpl.c_str());
-      push.sendInfluxDb2(doc);
-      _pushTestEnabled = true;
-    } else if (!_pushTestTarget.compareTo(PARAM_FORMAT_MQTT) &&
-               myConfig.hasTargetMqtt()) {
-      String tpl = push.getTemplate(GravmonGatewayPush::TEMPLATE_MQTT);
-      String doc = engine.create(tpl.c_str());
-      push.sendMqtt(doc);
-      _pushTestEnabled = true;
-    }
+    GravmonGatewayPush::Templates t = GravmonGatewayPush::TEMPLATE_MAX;
+
+    if (!_pushTestTarget.compareTo(PARAM_FORMAT_POST))
+      t = GravmonGatewayPush::TEMPLATE_HTTP1;
+    else if (!_pushTestTarget.compareTo(PARAM_FORMAT_POST2))
+      t = GravmonGatewayPush::TEMPLATE_HTTP2;
+    else if (!_pushTestTarget.compareTo(PARAM_FORMAT_GET))
+      t = GravmonGatewayPush::TEMPLATE_HTTP3;
+    else if (!_pushTestTarget.compareTo(PARAM_FORMAT_INFLUXDB))
+      t = GravmonGatewayPush::TEMPLATE_INFLUX;
+    else if (!_pushTestTarget.compareTo(PARAM_FORMAT_MQTT))
+      t = GravmonGatewayPush::TEMPLATE_MQTT;
+
+    // The test is sent by the target worker, same as a normal push
+    _pushTestEnabled = GravmonGatewayPush::isTargetEnabled(t);
 
-    engine.freeMemory();
-    push.clearTemplate();
-    _pushTestLastSuccess = push.getLastSuccess();
-    _pushTestLastCode = push.getLastCode();
-    if (_pushTestEnabled)
-      Log.notice(
-          F("WEB : Scheduled push test %s completed, success=%d, code=%d" CR),
-          _pushTestTarget.c_str(), _pushTestLastSuccess, _pushTestLastCode);
-    else
+    if (!_pushTestEnabled) {
       Log.notice(F("WEB : Scheduled push test %s failed, not enabled" CR),
                  _pushTestTarget.c_str());
+      _pushTestTask = false;
+    } else if (!myPush.queueTest(t)) {
+      Log.notice(F("WEB : Scheduled push test %s failed, queue is full" CR),
+                 _pushTestTarget.c_str());
+      _pushTestTask = false;
+    } else {
+      _pushTestQueued = true;
+    }
+  }
+
+  if (_pushTestQueued && myPush.isTestDone()) {
+    _pushTestLastSuccess = myPush.getTestSuccess();
+    _pushTestLastCode = myPush.getTestCode();
+    Log.notice(
+        F("WEB : Scheduled push test %s completed, success=%d, code=%d" CR),
+        _pushTestTarget.c_str(), _pushTestLastSuccess, _pushTestLastCode);
+    _pushTestQueued = false;
     _pushTestTask = false;
   }
 }
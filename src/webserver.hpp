@@ -27,15 +27,25 @@ SOFTWARE.
 #include <basewebserver.hpp>
 #include <blescanner.hpp>
 
+constexpr auto HTTP_READING_QUEUE_SIZE = 8;
+
+// Reading posted over http, waiting to be stored by the BLE task
+struct HttpReading {
+  uint64_t timestamp;
+  GravitymonReading reading;
+};
+
 class GravmonGatewayWebServer : public BaseWebServer {
  private:
   volatile bool _pushTestTask = false;
+  bool _pushTestQueued = false;  // Waiting for the push worker
 
   String _pushTestTarget;
   int _pushTestLastCode;
   bool _pushTestLastSuccess, _pushTestEnabled;
 
-  GravitymonData _gravitymon[NO_GRAVITYMON];
+  DeviceRegistry<GravitymonData> _gravitymon;
+  QueueHandle_t _readingQueue = nullptr;
 
   void webHandleStatus(AsyncWebServerRequest *request);
   void webHandleConfigRead(AsyncWebServerRequest *request);
@@ -54,12 +64,15 @@ class GravmonGatewayWebServer : public BaseWebServer {
  public:
   explicit GravmonGatewayWebServer(WebConfig *config);
 
-  int findGravitymonId(String id) {
-    for (int i = 0; i < NO_GRAVITYMON; i++)
-      if (_gravitymon[i].id == id || _gravitymon[i].id == "") return i;
-    return -1;
+  int findGravitymonId(const char *id) { return _gravitymon.findOrAdd(id); }
+  GravitymonData &getGravitymonData(int idx) { return _gravitymon.get(idx); }
+  void getGravitymonSnapshot(int idx, GravitymonSnapshot &s) {
+    _gravitymon.get(idx).snapshot.read(s);
   }
-  GravitymonData &getGravitymonData(int idx) { return _gravitymon[idx]; }
+  int getGravitymonCount() { return _gravitymon.size(); }
+  int getGravitymonCapacity() { return _gravitymon.capacity(); }
+  uint32_t getGravitymonEvictions() { return _gravitymon.getEvictions(); }
+  void processReadings();
 
   bool setupWebServer();
   void loop();
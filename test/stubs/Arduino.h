@@ -0,0 +1,101 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef TEST_STUBS_ARDUINO_H_
+#define TEST_STUBS_ARDUINO_H_
+
+// Minimal stand-in for the Arduino core, enough to build the platform
+// independent parts of the firmware for the host tests.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+
+#define F(x) x
+#define CR "\n"
+#define PROGMEM
+
+class String {
+ private:
+  std::string _s;
+
+ public:
+  String() {}
+  String(const char *s) : _s(s ? s : "") {}
+
+  String &operator=(const char *s) {
+    _s = s ? s : "";
+    return *this;
+  }
+  String &operator+=(const char *s) {
+    _s += s;
+    return *this;
+  }
+  String &operator+=(const String &s) {
+    _s += s._s;
+    return *this;
+  }
+  bool operator==(const String &s) const { return _s == s._s; }
+  bool operator!=(const String &s) const { return _s != s._s; }
+
+  bool reserve(size_t size) {
+    _s.reserve(size);
+    return true;
+  }
+  size_t length() const { return _s.length(); }
+  const char *c_str() const { return _s.c_str(); }
+};
+
+inline uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+inline uint32_t millis() { return micros() / 1000; }
+
+// Part of newlib on the ESP32, glibc only has it from 2.38
+#if defined(__GLIBC__) && \
+    (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t length = strlen(src);
+
+  if (size) {
+    size_t n = length < size ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+
+  return length;
+}
+#endif
+
+inline bool psramFound() { return false; }
+inline void *ps_malloc(size_t size) { return malloc(size); }
+
+#endif  // TEST_STUBS_ARDUINO_H_
+
+// EOF
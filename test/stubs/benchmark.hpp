@@ -0,0 +1,58 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#ifndef TEST_STUBS_BENCHMARK_HPP_
+#define TEST_STUBS_BENCHMARK_HPP_
+
+#include <stdio.h>
+#include <unity.h>
+
+#include <chrono>
+
+// Run fn() the given number of times and report the rate, the result is in
+// calls per second. Build with -O2 for figures that mean anything.
+template <typename Fn>
+double benchmark(const char *name, int iterations, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < iterations; i++) fn(i);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double rate = iterations / elapsed.count();
+  char msg[100];
+
+  snprintf(&msg[0], sizeof(msg), "%s: %.0f/s", name, rate);
+  TEST_MESSAGE(&msg[0]);
+  return rate;
+}
+
+// Keep the compiler from removing the work being measured
+template <typename T>
+inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif  // TEST_STUBS_BENCHMARK_HPP_
+
+// EOF
@@ -0,0 +1,156 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <ArduinoJson.h>
+#include <unity.h>
+
+#include <benchmark.hpp>
+#include <reading.cpp>
+#include <string>
+
+// Payloads as sent by gravitymon, ExtBeacon and GATT
+const char *const PAYLOADS[] = {
+    "{\"name\":\"gravitymon\",\"ID\":\"e4ca8c\",\"token\":\"\","
+    "\"interval\":900,\"temp\":22.4,\"temp_units\":\"C\","
+    "\"gravity\":1.0482,\"angle\":35.21,\"battery\":4.02,\"RSSI\":-72}",
+    "{\"name\":\"fermenter-2\",\"ID\":\"a5b1c2\","
+    "\"token\":\"0123456789abcdef0123456789abcdef\",\"interval\":300,"
+    "\"temperature\":19.75,\"temp_units\":\"F\",\"gravity\":1.012,"
+    "\"angle\":26.5,\"battery\":3.87,\"RSSI\":-80,"
+    "\"corr-gravity\":1.0121,\"run-time\":1.25}",
+    "{ \"ID\" : \"00ab12\" , \"gravity\" : 1.1 , \"angle\" : 45 ,\n"
+    "  \"temp\" : -2.5e0 , \"battery\" : 4.1 , \"extra\" : [1, {\"a\": 2}] }",
+};
+
+// The ArduinoJson path that the parser replaced, each value is converted to
+// a string or number through the document.
+bool jsonParseGravitymonReading(const char *json, size_t length,
+                                GravitymonReading &reading) {
+  DynamicJsonDocument in(1000);
+  DeserializationError err = deserializeJson(in, json, length);
+
+  if (err) return false;
+
+  memset(&reading, 0, sizeof(reading));
+  std::string id = in[PARAM_BLE_ID].as<std::string>();
+  std::string name = in[PARAM_BLE_NAME].as<std::string>();
+  std::string token = in[PARAM_BLE_TOKEN].as<std::string>();
+  std::string units = in[PARAM_BLE_TEMP_UNITS].as<std::string>();
+  copyString(&reading.id[0], sizeof(reading.id), id.c_str(), id.length());
+  copyString(&reading.name[0], sizeof(reading.name), name.c_str(),
+             name.length());
+  copyString(&reading.token[0], sizeof(reading.token), token.c_str(),
+             token.length());
+  copyString(&reading.tempUnits[0], sizeof(reading.tempUnits), units.c_str(),
+             units.length());
+  reading.temp = in[PARAM_BLE_TEMP].isNull()
+                     ? in[PARAM_BLE_TEMPERATURE].as<float>()
+                     : in[PARAM_BLE_TEMP].as<float>();
+  reading.gravity = in[PARAM_BLE_GRAVITY].as<float>();
+  reading.angle = in[PARAM_BLE_ANGLE].as<float>();
+  reading.battery = in[PARAM_BLE_BATTERY].as<float>();
+  reading.rssi = in[PARAM_BLE_RSSI].as<int>();
+  reading.interval = in[PARAM_BLE_INTERVAL].as<int>();
+  return reading.id[0] != 0;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_same_as_arduinojson() {
+  for (const char *json : PAYLOADS) {
+    GravitymonReading expected, reading;
+
+    TEST_ASSERT_TRUE(jsonParseGravitymonReading(json, strlen(json), expected));
+    TEST_ASSERT_TRUE(parseGravitymonReading(json, strlen(json), reading));
+
+    TEST_ASSERT_EQUAL_STRING(expected.id, reading.id);
+    TEST_ASSERT_EQUAL_STRING(expected.name, reading.name);
+    TEST_ASSERT_EQUAL_STRING(expected.token, reading.token);
+    TEST_ASSERT_EQUAL_STRING(expected.tempUnits, reading.tempUnits);
+    TEST_ASSERT_EQUAL_FLOAT(expected.temp, reading.temp);
+    TEST_ASSERT_EQUAL_FLOAT(expected.gravity, reading.gravity);
+    TEST_ASSERT_EQUAL_FLOAT(expected.angle, reading.angle);
+    TEST_ASSERT_EQUAL_FLOAT(expected.battery, reading.battery);
+    TEST_ASSERT_EQUAL_INT(expected.rssi, reading.rssi);
+    TEST_ASSERT_EQUAL_INT(expected.interval, reading.interval);
+  }
+}
+
+void test_reject() {
+  const char *const invalid[] = {
+      "",
+      "{}",
+      "{\"gravity\":1.05}",
+      "{\"ID\":\"\"}",
+      "{\"ID\":\"e4ca8c\"",
+      "{\"ID\" \"e4ca8c\"}",
+      "[\"ID\",\"e4ca8c\"]",
+  };
+  GravitymonReading reading;
+
+  for (const char *json : invalid)
+    TEST_ASSERT_FALSE(parseGravitymonReading(json, strlen(json), reading));
+}
+
+void test_truncate() {
+  const char *json =
+      "{\"ID\":\"0123456789012345678901234567890\",\"temp_units\":\"CF\"}";
+  GravitymonReading reading;
+
+  TEST_ASSERT_TRUE(parseGravitymonReading(json, strlen(json), reading));
+  TEST_ASSERT_EQUAL_STRING("0123456789012345678", reading.id);
+  TEST_ASSERT_EQUAL_STRING("C", reading.tempUnits);
+}
+
+void test_benchmark() {
+  constexpr int COUNT = 300000;
+  constexpr int PAYLOAD_COUNT = sizeof(PAYLOADS) / sizeof(PAYLOADS[0]);
+
+  double before = benchmark("ArduinoJson", COUNT, [](int i) {
+    const char *json = PAYLOADS[i % PAYLOAD_COUNT];
+    GravitymonReading reading;
+    jsonParseGravitymonReading(json, strlen(json), reading);
+    doNotOptimize(reading.gravity);
+  });
+
+  double after = benchmark("Fixed key parser", COUNT, [](int i) {
+    const char *json = PAYLOADS[i % PAYLOAD_COUNT];
+    GravitymonReading reading;
+    parseGravitymonReading(json, strlen(json), reading);
+    doNotOptimize(reading.gravity);
+  });
+
+  TEST_ASSERT_GREATER_THAN(before, after);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_as_arduinojson);
+  RUN_TEST(test_reject);
+  RUN_TEST(test_truncate);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+// EOF
@@ -0,0 +1,188 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <unity.h>
+
+#include <benchmark.hpp>
+#include <deviceregistry.hpp>
+
+struct Device {
+  uint32_t chipId = 0;
+  uint64_t mac = 0;
+  char id[20] = "";
+  bool hashedId = false;
+  bool updated = false;
+  uint16_t interval = 0;
+  int32_t silent = 0;
+
+  int32_t getSilentTime() const { return silent; }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_registry_lookup() {
+  DeviceRegistry<Device> registry;
+
+  TEST_ASSERT_EQUAL_INT(8, registry.init(8));
+
+  for (int i = 0; i < 8; i++) {
+    int idx = registry.findOrAdd(0x1000 + i);
+    TEST_ASSERT_EQUAL_INT(i, idx);
+    registry.setMac(idx, 0xaa0000 + i);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    TEST_ASSERT_EQUAL_INT(i, registry.find(0x1000 + i));
+    TEST_ASSERT_EQUAL_INT(i, registry.findByMac(0xaa0000 + i));
+  }
+
+  TEST_ASSERT_EQUAL_INT(-1, registry.find(0x2000));
+  TEST_ASSERT_EQUAL_INT(-1, registry.findByMac(0xbb0000));
+
+  // Full and nobody overdue
+  TEST_ASSERT_EQUAL_INT(-1, registry.findOrAdd(0x2000));
+}
+
+void test_registry_evict() {
+  DeviceRegistry<Device> registry;
+
+  registry.init(4);
+  for (uint32_t i = 0; i < 4; i++) {
+    int idx = registry.findOrAdd(0x1000 + i);
+    registry.setMac(idx, 0xaa0000 + i);
+  }
+
+  registry.get(2).silent = REGISTRY_STALE_MIN + 100;
+  registry.get(3).silent = REGISTRY_STALE_MIN + 10;
+
+  int idx = registry.findOrAdd(0x2000);
+  TEST_ASSERT_EQUAL_INT(2, idx);
+  TEST_ASSERT_EQUAL_UINT32(1, registry.getEvictions());
+  TEST_ASSERT_EQUAL_INT(-1, registry.find(0x1002));
+  TEST_ASSERT_EQUAL_INT(-1, registry.findByMac(0xaa0002));
+  TEST_ASSERT_EQUAL_INT(2, registry.find(0x2000));
+
+  // The other entries survive the backward shift deletion
+  TEST_ASSERT_EQUAL_INT(0, registry.find(0x1000));
+  TEST_ASSERT_EQUAL_INT(1, registry.find(0x1001));
+  TEST_ASSERT_EQUAL_INT(3, registry.find(0x1003));
+  TEST_ASSERT_EQUAL_INT(3, registry.findByMac(0xaa0003));
+
+  // Address moved to another device
+  registry.setMac(0, 0xaa0001);
+  TEST_ASSERT_EQUAL_INT(0, registry.findByMac(0xaa0001));
+  TEST_ASSERT_EQUAL_INT(-1, registry.findByMac(0xaa0000));
+}
+
+void test_registry_stale() {
+  DeviceRegistry<Device> registry;
+
+  registry.init(2);
+  registry.findOrAdd(0x1000);
+  registry.findOrAdd(0x1001);
+
+  // Beacons have no interval, a short silence is not enough
+  registry.get(0).silent = 10;
+  TEST_ASSERT_EQUAL_INT(-1, registry.findOrAdd(0x2000));
+
+  // Overdue by less than a few intervals
+  registry.get(0).interval = 900;
+  registry.get(0).silent = 900 * REGISTRY_STALE_INTERVALS - 1;
+  TEST_ASSERT_EQUAL_INT(-1, registry.findOrAdd(0x2000));
+
+  // A reading waiting to be pushed is never dropped
+  registry.get(0).silent = 900 * REGISTRY_STALE_INTERVALS + 1;
+  registry.get(0).updated = true;
+  TEST_ASSERT_EQUAL_INT(-1, registry.findOrAdd(0x2000));
+
+  registry.get(0).updated = false;
+  TEST_ASSERT_EQUAL_INT(0, registry.findOrAdd(0x2000));
+  TEST_ASSERT_EQUAL_INT(1, registry.find(0x1001));
+}
+
+void test_chip_id() {
+  bool hashed;
+
+  TEST_ASSERT_EQUAL_UINT32(0xe4ca8c, deviceIdToChipId("e4ca8c", &hashed));
+  TEST_ASSERT_FALSE(hashed);
+  TEST_ASSERT_EQUAL_UINT32(0xffffffff, deviceIdToChipId("ffffffff", &hashed));
+  TEST_ASSERT_FALSE(hashed);
+
+  // Too long for 32 bits or not hex
+  uint32_t a = deviceIdToChipId("123456789abc", &hashed);
+  TEST_ASSERT_TRUE(hashed);
+  uint32_t b = deviceIdToChipId("223456789abc", &hashed);
+  TEST_ASSERT_TRUE(hashed);
+  TEST_ASSERT_NOT_EQUAL(a, b);
+  TEST_ASSERT_NOT_EQUAL(0xffffffff, a);
+  deviceIdToChipId("fermenter", &hashed);
+  TEST_ASSERT_TRUE(hashed);
+}
+
+// Devices with hashed ids only match on the same id string, even when the
+// hashes collide with each other or with a real chip id
+void test_registry_hashed_id() {
+  DeviceRegistry<Device> registry;
+  uint32_t chipId = deviceIdToChipId("fermenter");
+
+  registry.init(8);
+
+  int beacon = registry.findOrAdd(chipId);
+  int first = registry.findOrAdd("fermenter");
+  int second = registry.findOrAdd(chipId, "other");
+
+  TEST_ASSERT_NOT_EQUAL(beacon, first);
+  TEST_ASSERT_NOT_EQUAL(first, second);
+  TEST_ASSERT_EQUAL_INT(beacon, registry.find(chipId));
+  TEST_ASSERT_EQUAL_INT(first, registry.find("fermenter"));
+  TEST_ASSERT_EQUAL_INT(second, registry.find(chipId, "other"));
+  TEST_ASSERT_EQUAL_STRING("fermenter", registry.get(first).id);
+
+  // Hex ids are the chip id, the same device as the beacon
+  TEST_ASSERT_EQUAL_INT(registry.findOrAdd(0xe4ca8c), registry.find("e4ca8c"));
+}
+
+void test_benchmark() {
+  static DeviceRegistry<Device> registry;
+
+  registry.init(256);
+  for (uint32_t i = 0; i < 256; i++) registry.findOrAdd(i * 7919);
+
+  benchmark("Registry lookup", 10000000, [](int i) {
+    doNotOptimize(registry.find((i & 255) * 7919));
+  });
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_registry_lookup);
+  RUN_TEST(test_registry_evict);
+  RUN_TEST(test_registry_stale);
+  RUN_TEST(test_chip_id);
+  RUN_TEST(test_registry_hashed_id);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+// EOF
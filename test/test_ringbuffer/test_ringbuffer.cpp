@@ -0,0 +1,125 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <unity.h>
+
+#include <benchmark.hpp>
+#include <ringbuffer.hpp>
+#include <thread>
+
+struct Entry {
+  uint32_t seq;
+  uint32_t check;
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_ringbuffer_order() {
+  RingBuffer<Entry, 4> ring;
+
+  TEST_ASSERT_NULL(ring.peek());
+
+  for (uint32_t i = 0; i < 4; i++) {
+    Entry *e = ring.acquire();
+    TEST_ASSERT_NOT_NULL(e);
+    e->seq = i;
+    ring.commit();
+  }
+
+  TEST_ASSERT_NULL(ring.acquire());
+  TEST_ASSERT_EQUAL_UINT32(1, ring.getOverflow());
+  TEST_ASSERT_EQUAL_UINT32(4, ring.getHighWater());
+
+  for (uint32_t i = 0; i < 4; i++) {
+    Entry *e = ring.peek();
+    TEST_ASSERT_NOT_NULL(e);
+    TEST_ASSERT_EQUAL_UINT32(i, e->seq);
+    ring.release();
+  }
+
+  TEST_ASSERT_NULL(ring.peek());
+  TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+}
+
+// A producer and a consumer thread, every entry that was committed must be
+// read once, in order and complete.
+void test_ringbuffer_threads() {
+  constexpr uint32_t COUNT = 200000;
+  static RingBuffer<Entry, 32> ring;
+  uint32_t received = 0, errors = 0;
+
+  std::thread consumer([&]() {
+    uint32_t next = 0;
+
+    while (next < COUNT) {
+      Entry *e = ring.peek();
+      if (!e) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (e->seq != next || e->check != ~e->seq) errors++;
+      next = e->seq + 1;
+      received++;
+      ring.release();
+    }
+  });
+
+  for (uint32_t i = 0; i < COUNT;) {
+    Entry *e = ring.acquire();
+    if (!e) {
+      std::this_thread::yield();
+      continue;
+    }
+    e->seq = i;
+    e->check = ~i;
+    ring.commit();
+    i++;
+  }
+
+  consumer.join();
+  TEST_ASSERT_EQUAL_UINT32(0, errors);
+  TEST_ASSERT_EQUAL_UINT32(COUNT, received);
+}
+
+void test_benchmark() {
+  static RingBuffer<Entry, 32> ring;
+
+  benchmark("Ring buffer commit and release", 10000000, [](int i) {
+    Entry *e = ring.acquire();
+    e->seq = i;
+    ring.commit();
+    doNotOptimize(ring.peek()->seq);
+    ring.release();
+  });
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ringbuffer_order);
+  RUN_TEST(test_ringbuffer_threads);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+// EOF
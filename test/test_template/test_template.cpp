@@ -0,0 +1,264 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <unity.h>
+
+#include <benchmark.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The firmware headers are replaced by the few settings the templates use
+#define SRC_CONFIG_HPP_
+#define SRC_HELPER_HPP_
+#define SRC_MAIN_HPP_
+
+constexpr auto DECIMALS_SG = 4;
+constexpr auto DECIMALS_PLATO = 2;
+constexpr auto DECIMALS_TEMP = 2;
+constexpr auto DECIMALS_RUNTIME = 2;
+constexpr auto DECIMALS_TILT = 3;
+constexpr auto DECIMALS_BATTERY = 2;
+
+class FakeConfig {
+ public:
+  char tempFormat = 'C';
+  char gravityFormat = 'G';
+
+  const char *getMDNS() { return "gravmon-gw"; }
+  const char *getToken() { return "default-token"; }
+  bool isTempFormatC() { return tempFormat == 'C'; }
+  char getTempFormat() { return tempFormat; }
+  bool isGravitySG() { return gravityFormat == 'G'; }
+  char getGravityFormat() { return gravityFormat; }
+};
+
+FakeConfig myConfig;
+
+float convertCtoF(float c) { return (c * 1.8) + 32.0; }
+float convertToPlato(float sg) { return sg ? 259.0 - (259.0 / sg) : 0; }
+
+#include <pushtemplate.cpp>
+
+// Default templates from pushtarget.cpp
+const char *const TEMPLATES[] = {
+    "{"
+    "\"name\": \"${mdns}\", "
+    "\"ID\": \"${id}\", "
+    "\"token\": \"${token}\", "
+    "\"interval\": ${sleep-interval}, "
+    "\"temperature\": ${temp}, "
+    "\"temp_units\": \"${temp-unit}\", "
+    "\"gravity\": ${gravity}, "
+    "\"angle\": ${angle}, "
+    "\"battery\": ${battery}, "
+    "\"RSSI\": ${rssi}, "
+    "}",
+    "?name=${mdns}"
+    "&id=${id}"
+    "&token=${token2}"
+    "&interval=${sleep-interval}"
+    "&temperature=${temp}"
+    "&temp-units=${temp-unit}"
+    "&gravity=${gravity}"
+    "&angle=${angle}"
+    "&battery=${battery}"
+    "&rssi=${rssi}"
+    "&corr-gravity=${corr-gravity}"
+    "&gravity-unit=${gravity-unit}"
+    "&run-time=${run-time}",
+    "measurement,host=${mdns},device=${id},temp-format=${temp-unit},gravity-"
+    "format=${gravity-unit} "
+    "gravity=${gravity},corr-gravity=${corr-gravity},angle=${angle},temp=${"
+    "temp},battery=${battery},"
+    "rssi=${rssi}\n",
+    "ispindel/${mdns}/tilt:${angle}|"
+    "ispindel/${mdns}/temperature:${temp}|"
+    "ispindel/${mdns}/temp_units:${temp-unit}|"
+    "ispindel/${mdns}/battery:${battery}|"
+    "ispindel/${mdns}/gravity:${gravity}|"
+    "ispindel/${mdns}/interval:${sleep-interval}|"
+    "ispindel/${mdns}/RSSI:${rssi}|",
+    // Unknown keys and unterminated variables are kept as text
+    "${unknown} ${id}${id} $ {gravity-sg} ${gravity-plato}${temp-c}/${temp-f} "
+    "${battery-percent} ${corr-gravity-sg} ${corr-gravity-plato} ${tilt} "
+    "${app-ver} ${app-build} ${temp",
+};
+
+constexpr int TEMPLATE_COUNT = sizeof(TEMPLATES) / sizeof(TEMPLATES[0]);
+
+struct Reading {
+  float angle;
+  float gravitySG;
+  float tempC;
+  float battery;
+  int interval;
+  const char *id;
+  const char *token;
+  const char *name;
+};
+
+const Reading READINGS[] = {
+    {35.21, 1.0482, 22.4, 4.02, 900, "e4ca8c", "", ""},
+    {26.5, 1.012, -2.5, 3.72, 300, "a5b1c2", "secret", "fermenter-2"},
+};
+
+static std::string number(float value, int decimals) {
+  char buf[20];
+  snprintf(&buf[0], sizeof(buf), "%.*f", decimals, value);
+  return &buf[0];
+}
+
+// The TemplatingEngine path that was replaced, every variable is formatted
+// and then each key is searched for and replaced in the whole document.
+static std::string replaceRender(const char *tpl, const Reading &r) {
+  float runTime = 0, corrGravitySG = r.gravitySG;
+  bool sg = myConfig.isGravitySG();
+  std::vector<std::pair<const char *, std::string> > vals = {
+      {TPL_MDNS, strlen(r.name) ? r.name : myConfig.getMDNS()},
+      {TPL_ID, r.id},
+      {TPL_TOKEN, strlen(r.token) ? r.token : myConfig.getToken()},
+      {TPL_TOKEN2, strlen(r.token) ? r.token : myConfig.getToken()},
+      {TPL_TEMP, number(myConfig.isTempFormatC() ? r.tempC
+                                                 : convertCtoF(r.tempC),
+                        DECIMALS_TEMP)},
+      {TPL_TEMP_C, number(r.tempC, DECIMALS_TEMP)},
+      {TPL_TEMP_F, number(convertCtoF(r.tempC), DECIMALS_TEMP)},
+      {TPL_TEMP_UNITS, std::string(1, myConfig.getTempFormat())},
+      {TPL_BATTERY, number(r.battery, DECIMALS_BATTERY)},
+      {TPL_BATTERY_PERCENT, std::to_string(getBatteryCharge(r.battery))},
+      {TPL_SLEEP_INTERVAL, std::to_string(r.interval)},
+      {TPL_RSSI, std::to_string(WiFi.RSSI())},
+      {TPL_RUN_TIME, number(runTime, DECIMALS_RUNTIME)},
+      {TPL_ANGLE, number(r.angle, DECIMALS_TILT)},
+      {TPL_TILT, number(r.angle, DECIMALS_TILT)},
+      {TPL_GRAVITY, sg ? number(r.gravitySG, DECIMALS_SG)
+                       : number(convertToPlato(r.gravitySG), DECIMALS_PLATO)},
+      {TPL_GRAVITY_G, number(r.gravitySG, DECIMALS_SG)},
+      {TPL_GRAVITY_P, number(convertToPlato(r.gravitySG), DECIMALS_PLATO)},
+      {TPL_GRAVITY_CORR,
+       sg ? number(corrGravitySG, DECIMALS_SG)
+          : number(convertToPlato(corrGravitySG), DECIMALS_PLATO)},
+      {TPL_GRAVITY_CORR_G, number(corrGravitySG, DECIMALS_SG)},
+      {TPL_GRAVITY_CORR_P,
+       number(convertToPlato(corrGravitySG), DECIMALS_PLATO)},
+      {TPL_GRAVITY_UNIT, std::string(1, myConfig.getGravityFormat())},
+      {TPL_APP_VER, CFG_APPVER},
+      {TPL_APP_BUILD, CFG_GITREV},
+  };
+  std::string doc = tpl;
+
+  for (const auto &v : vals) {
+    size_t length = strlen(v.first);
+
+    for (size_t pos = doc.find(v.first); pos != std::string::npos;
+         pos = doc.find(v.first, pos + v.second.length()))
+      doc.replace(pos, length, v.second);
+  }
+
+  return doc;
+}
+
+static String compiledRender(CompiledTemplate &tpl, const Reading &r) {
+  TemplateValues values(r.angle, r.gravitySG, r.tempC, r.battery, r.interval,
+                        r.id, r.token, r.name);
+  String doc;
+
+  tpl.render(values, doc);
+  return doc;
+}
+
+void setUp() {
+  myConfig.tempFormat = 'C';
+  myConfig.gravityFormat = 'G';
+}
+
+void tearDown() {}
+
+void test_same_as_replace() {
+  const char formats[][2] = {{'C', 'G'}, {'F', 'P'}};
+
+  for (const auto &f : formats) {
+    myConfig.tempFormat = f[0];
+    myConfig.gravityFormat = f[1];
+
+    for (const char *t : TEMPLATES) {
+      CompiledTemplate tpl;
+      tpl.compile(t);
+
+      for (const Reading &r : READINGS) {
+        std::string expected = replaceRender(t, r);
+        TEST_ASSERT_EQUAL_STRING(expected.c_str(),
+                                 compiledRender(tpl, r).c_str());
+      }
+    }
+  }
+}
+
+void test_values_shared() {
+  const Reading &r = READINGS[0];
+  TemplateValues values(r.angle, r.gravitySG, r.tempC, r.battery, r.interval,
+                        r.id, r.token, r.name);
+
+  // Formatted once, every later call returns the same buffer
+  const char *gravity = values.get(TPL_VAR_GRAVITY);
+  TEST_ASSERT_EQUAL_STRING("1.0482", gravity);
+  TEST_ASSERT_EQUAL_PTR(gravity, values.get(TPL_VAR_GRAVITY));
+}
+
+void test_benchmark() {
+  constexpr int COUNT = 20000;
+  CompiledTemplate compiled[TEMPLATE_COUNT];
+
+  for (int i = 0; i < TEMPLATE_COUNT; i++) compiled[i].compile(TEMPLATES[i]);
+
+  // One reading rendered for each of the default targets
+  double before = benchmark("String replace", COUNT, [](int i) {
+    for (int t = 0; t < TEMPLATE_COUNT - 1; t++)
+      doNotOptimize(replaceRender(TEMPLATES[t], READINGS[i % 2]).length());
+  });
+
+  double after = benchmark("Compiled template", COUNT, [&compiled](int i) {
+    const Reading &r = READINGS[i % 2];
+    TemplateValues values(r.angle, r.gravitySG, r.tempC, r.battery,
+                          r.interval, r.id, r.token, r.name);
+    String doc;
+
+    for (int t = 0; t < TEMPLATE_COUNT - 1; t++) {
+      compiled[t].render(values, doc);
+      doNotOptimize(doc.length());
+    }
+  });
+
+  TEST_ASSERT_GREATER_THAN(before, after);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_as_replace);
+  RUN_TEST(test_values_shared);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+// EOF
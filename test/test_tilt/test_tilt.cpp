@@ -0,0 +1,192 @@
+/*
+MIT License
+
+Copyright (c) 2024 Magnus
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+#include <stdlib.h>
+#include <unity.h>
+
+#include <benchmark.hpp>
+#include <string>
+#include <tiltbeacon.hpp>
+#include <vector>
+
+// The decoder that was replaced, the bytes are formatted as hex and parsed
+// back. Bytes are passed as unsigned, the old code sign extended bytes >=
+// 0x80 where char is signed and then read them as 0xff.
+struct OldTiltBeacon {
+  float gravity;
+  float tempF;
+  uint8_t txPower;
+};
+
+bool oldDecodeTiltBeacon(const std::string &advertStringHex,
+                         OldTiltBeacon *beacon) {
+  if (advertStringHex[0] != 0x4c || advertStringHex[1] != 0x00 ||
+      advertStringHex[2] != 0x02 || advertStringHex[3] != 0x15)
+    return false;
+
+  char hexCode[3] = {'\0'};
+  char colorArray[33] = {'\0'};
+  char tempArray[5] = {'\0'};
+  char gravityArray[5] = {'\0'};
+  char txPowerArray[3] = {'\0'};
+
+  for (size_t i = 4; i < advertStringHex.length(); i++) {
+    snprintf(hexCode, sizeof(hexCode), "%.2x",
+             static_cast<uint8_t>(advertStringHex[i]));
+    if ((i > 3) && (i < 20)) strncat(colorArray, hexCode, 2);
+    if (i == 20 || i == 21) strncat(tempArray, hexCode, 2);
+    if (i == 22 || i == 23) strncat(gravityArray, hexCode, 2);
+    if (i == 24) strncat(txPowerArray, hexCode, 2);
+  }
+
+  uint16_t temp = std::strtoul(tempArray, nullptr, 16);
+  uint16_t gravity = std::strtoul(gravityArray, nullptr, 16);
+  uint8_t txPower = std::strtoul(txPowerArray, nullptr, 16);
+
+  float gravityFactor = 1000;
+  float tempFactor = 1;
+
+  if (gravity >= 5000) {  // check for tilt PRO
+    gravityFactor = 10000;
+    tempFactor = 10;
+  }
+
+  beacon->gravity = gravity / gravityFactor;
+  beacon->tempF = temp / tempFactor;
+  beacon->txPower = txPower;
+  return true;
+}
+
+constexpr auto ADVERT_COUNT = 200000;
+
+struct Advert {
+  uint8_t data[25];
+  uint8_t length;
+};
+
+std::vector<Advert> adverts;
+
+// Random Tilt adverts with values over the whole range, both with and
+// without the tx power byte
+void setUp() {
+  if (!adverts.empty()) return;
+
+  const uint8_t header[] = {0x4c, 0x00, 0x02, 0x15, 0xa4, 0x95, 0xbb, 0x10,
+                            0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12, 0x13, 0x70,
+                            0xf0, 0x2d, 0x74, 0xde};
+  srand(1);
+
+  for (int i = 0; i < ADVERT_COUNT; i++) {
+    Advert a;
+    memcpy(&a.data[0], &header[0], sizeof(header));
+    for (int j = 20; j < 25; j++) a.data[j] = rand() & 0xff;
+    a.length = (i % 8) ? 25 : 24;
+    adverts.push_back(a);
+  }
+}
+
+void tearDown() {}
+
+void test_known_advert() {
+  // Tilt: 80F, 1.241 SG, Tilt Pro: 80.5F, 1.0512 SG
+  const uint8_t tilt[] = {0x4c, 0x00, 0x02, 0x15, 0xa4, 0x95, 0xbb,
+                          0x40, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12,
+                          0x13, 0x70, 0xf0, 0x2d, 0x74, 0xde, 0x00,
+                          0x50, 0x04, 0xd9, 0xc5};
+  const uint8_t pro[] = {0x4c, 0x00, 0x02, 0x15, 0xa4, 0x95, 0xbb,
+                         0x40, 0xc5, 0xb1, 0x4b, 0x44, 0xb5, 0x12,
+                         0x13, 0x70, 0xf0, 0x2d, 0x74, 0xde, 0x03,
+                         0x25, 0x29, 0x10, 0x05};
+  TiltBeacon beacon;
+
+  TEST_ASSERT_TRUE(decodeTiltBeacon(&tilt[0], sizeof(tilt), &beacon));
+  TEST_ASSERT_FALSE(beacon.isPro());
+  TEST_ASSERT_EQUAL_FLOAT(80, beacon.getTempF());
+  TEST_ASSERT_EQUAL_FLOAT(1.241f, beacon.getGravity());
+  TEST_ASSERT_EQUAL_UINT8(0xc5, beacon.txPower);
+
+  TEST_ASSERT_TRUE(decodeTiltBeacon(&pro[0], sizeof(pro), &beacon));
+  TEST_ASSERT_TRUE(beacon.isPro());
+  TEST_ASSERT_EQUAL_FLOAT(80.5f, beacon.getTempF());
+  TEST_ASSERT_EQUAL_FLOAT(1.0512f, beacon.getGravity());
+}
+
+void test_reject() {
+  uint8_t advert[25] = {0x4c, 0x00, 0x02, 0x15};
+  TiltBeacon beacon;
+
+  TEST_ASSERT_FALSE(decodeTiltBeacon(&advert[0], 23, &beacon));
+  advert[2] = 0x03;
+  TEST_ASSERT_FALSE(decodeTiltBeacon(&advert[0], sizeof(advert), &beacon));
+}
+
+// The values must be bit for bit the same as with the old decoder
+void test_bit_exact() {
+  for (const Advert &a : adverts) {
+    std::string hex(reinterpret_cast<const char *>(&a.data[0]), a.length);
+    OldTiltBeacon expected;
+    TiltBeacon beacon;
+
+    TEST_ASSERT_TRUE(oldDecodeTiltBeacon(hex, &expected));
+    TEST_ASSERT_TRUE(decodeTiltBeacon(&a.data[0], a.length, &beacon));
+
+    float gravity = beacon.getGravity();
+    float tempF = beacon.getTempF();
+
+    TEST_ASSERT_EQUAL_MEMORY(&expected.gravity, &gravity, sizeof(float));
+    TEST_ASSERT_EQUAL_MEMORY(&expected.tempF, &tempF, sizeof(float));
+    TEST_ASSERT_EQUAL_UINT8(expected.txPower, beacon.txPower);
+  }
+}
+
+void test_benchmark() {
+  double before = benchmark("Hex string decoder", ADVERT_COUNT, [](int i) {
+    const Advert &a = adverts[i];
+    std::string hex(reinterpret_cast<const char *>(&a.data[0]), a.length);
+    OldTiltBeacon beacon;
+    oldDecodeTiltBeacon(hex, &beacon);
+    doNotOptimize(beacon);
+  });
+
+  double after = benchmark("Byte span decoder", ADVERT_COUNT, [](int i) {
+    const Advert &a = adverts[i];
+    TiltBeacon beacon = {};
+    decodeTiltBeacon(&a.data[0], a.length, &beacon);
+    float gravity = beacon.getGravity(), tempF = beacon.getTempF();
+    doNotOptimize(gravity);
+    doNotOptimize(tempF);
+  });
+
+  TEST_ASSERT_GREATER_THAN(before, after);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_known_advert);
+  RUN_TEST(test_reject);
+  RUN_TEST(test_bit_exact);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
+
+// EOF